@@ -26,26 +26,59 @@
  */
 
 #include "PortIdentification.h"
+#include "utils/archive.hpp"
 #include "utils/mpi_helper.hpp"
 
 #pragma once
 
+class Actor;
 class AbstractOutPort;
+class ProgressEngine;
 
 class AbstractInPort {
+
+  friend class Actor;
+
 public:
   virtual void *getChannel() const = 0;
 
+  virtual size_t available() const = 0;
+
   virtual std::string toString() const = 0;
 
-  virtual void receiveMessagesFrom(PortIdentification<AbstractOutPort>) = 0;
+  std::string getName() const { return myIdentification.getName(); }
+
+  virtual void receiveMessagesFrom(PortIdentification<AbstractOutPort>,
+                                   ProgressEngine *) = 0;
+
+  // Ports that accept more than one source merge them into one channel.
+  virtual bool acceptsManySources() const { return false; }
+
+  // Called before the graph runs, once all sources are connected. Ports
+  // that divide their credits among remote sources grant them here.
+  virtual void grantCredits() {}
+
+  // Removes the connection to source and cancels the receives posted for
+  // it. Tokens that already arrived stay in the channel.
+  virtual void
+  disconnect(const PortIdentification<AbstractOutPort> &source) = 0;
+
+  // Move the buffered tokens into an archive and back, when the owning
+  // actor migrates.
+  virtual void saveTokens(archive::OutArchive &out) = 0;
+
+  virtual void restoreTokens(archive::InArchive &in) = 0;
 
   template <class T>
   explicit AbstractInPort(T &&name)
-      : myIdentification(std::forward<T>(name), mpi::me()) {}
+      : myIdentification(std::forward<T>(name), mpi::me()), owner(nullptr) {}
 
   virtual ~AbstractInPort() = default;
 
+  // Called whenever tokens arrive in this port's channel.
+  void notifyOwner() const;
+
 protected:
   PortIdentification<AbstractInPort> myIdentification;
+  Actor *owner;
 };
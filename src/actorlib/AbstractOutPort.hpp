@@ -29,20 +29,42 @@
 
 #pragma once
 
+class Actor;
 class AbstractInPort;
+class ProgressEngine;
 
 class AbstractOutPort {
+
+  friend class Actor;
+
 public:
   virtual std::string toString() const = 0;
 
-  virtual void sendMessagesTo(PortIdentification<AbstractInPort>) = 0;
+  std::string getName() const { return myIdentification.getName(); }
+
+  virtual size_t freeCapacity() const = 0;
+
+  virtual void sendMessagesTo(PortIdentification<AbstractInPort>,
+                              ProgressEngine *) = 0;
+
+  // Ports that accept more than one destination send every token to all.
+  virtual bool acceptsManyDestinations() const { return false; }
+
+  // Removes the connection to destination. Only valid while no message of
+  // this port is in flight.
+  virtual void
+  disconnect(const PortIdentification<AbstractInPort> &destination) = 0;
 
   template <class T>
   explicit AbstractOutPort(T &&name)
-      : myIdentification(std::forward<T>(name), mpi::me()) {}
+      : myIdentification(std::forward<T>(name), mpi::me()), owner(nullptr) {}
 
   virtual ~AbstractOutPort() = default;
 
+  // Called whenever slots are freed in the channel this port writes to.
+  void notifyOwner() const;
+
 protected:
   PortIdentification<AbstractOutPort> myIdentification;
+  Actor *owner;
 };
@@ -34,39 +34,101 @@
 #include "ActorGraph.hpp"
 #include "InPort.hpp"
 #include "OutPort.hpp"
+#include "WorkStealingExecutor.hpp"
 
 using namespace std;
 using namespace std::string_literals;
 
+Actor::~Actor() {
+  for (auto inPort : inPorts)
+    delete inPort;
+  for (auto outPort : outPorts)
+    delete outPort;
+}
+
 std::string Actor::toString() const {
   stringstream ss;
   ss << "Actor( " << name << " ) { ";
-  for (auto &aip : this->inPorts) {
-    ss << aip.second->toString() << " ";
+  for (auto aip : this->inPorts) {
+    ss << aip->toString() << " ";
   }
-  for (auto &aop : this->outPorts) {
-    ss << aop.second->toString() << " ";
+  for (auto aop : this->outPorts) {
+    ss << aop->toString() << " ";
   }
   ss << "}";
   return ss.str();
 }
 
 AbstractInPort *Actor::getInPort(const string &portName) const {
-  auto res = inPorts.find(portName);
-  if (res != inPorts.end()) {
-    return res->second;
-  } else {
-    throw std::runtime_error("Actor "s + this->toString() +
-                             "has no InPort with id "s + portName);
+  return inPorts[getInPortIndex(portName)];
+}
+
+size_t Actor::getInPortIndex(const string &portName) const {
+  for (size_t index = 0; index < inPorts.size(); index++) {
+    if (inPorts[index]->getName() == portName)
+      return index;
   }
+  throw std::runtime_error("Actor "s + this->toString() +
+                           "has no InPort with id "s + portName);
 }
 
 AbstractOutPort *Actor::getOutPort(const string &portName) const {
-  auto res = outPorts.find(name);
-  if (res != outPorts.end()) {
-    return res->second;
-  } else {
-    throw std::runtime_error("Actor "s + this->toString() +
-                             "has no OutPort with name "s + name);
+  for (auto outPort : outPorts) {
+    if (outPort->getName() == portName)
+      return outPort;
   }
-}
\ No newline at end of file
+  throw std::runtime_error("Actor "s + this->toString() +
+                           "has no OutPort with name "s + portName);
+}
+void Actor::addFiringRule(FiringRule rule) {
+  firingRules.push_back(std::move(rule));
+}
+
+bool Actor::actBatch(size_t budget) {
+  for (size_t firing = 0; firing < budget; firing++) {
+    if (firing > 0 && !isReady())
+      break;
+    if (act())
+      return true;
+  }
+  return false;
+}
+
+bool Actor::isReady() const {
+  if (firingRules.empty())
+    return true;
+
+  for (auto &rule : firingRules) {
+    if (rule.isSatisfied())
+      return true;
+  }
+  return false;
+}
+
+void Actor::setPriority(int priority) {
+  this->priority = priority;
+  isPriorityFixed = true;
+}
+
+void Actor::serialize(archive::OutArchive &) const {
+  throw std::runtime_error("Actor "s + name + " does not support migration.");
+}
+
+void Actor::deserialize(archive::InArchive &) {
+  throw std::runtime_error("Actor "s + name + " does not support migration.");
+}
+
+void Actor::trigger() {
+  if (executor)
+    executor->notify(this);
+}
+
+void AbstractInPort::notifyOwner() const {
+  if (owner)
+    owner->trigger();
+}
+
+void AbstractOutPort::notifyOwner() const {
+  if (owner)
+    owner->trigger();
+}
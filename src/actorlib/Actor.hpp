@@ -26,33 +26,71 @@
  *
  */
 
+#include "FanInPort.hpp"
+#include "FiringRule.hpp"
 #include "InPort.hpp"
+#include "MulticastOutPort.hpp"
 #include "OutPort.hpp"
+#include "utils/archive.hpp"
+#include <atomic>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 #pragma once
 
 class ActorGraph;
 class AbstractInPort;
 class AbstractOutPort;
+class WorkStealingExecutor;
+
+constexpr int INVALID_ACTOR_ID = -1;
+
+enum class SchedulingState : int {
+  WAITING,
+  QUEUED,
+  RUNNING,
+  RESCHEDULE,
+  FINISHED
+};
 
 class Actor {
 
   friend class ActorGraph;
+  friend class WorkStealingExecutor;
 
 protected:
+  // Tokens of remote connections are encoded by Codec, which has to be the
+  // same on both ends.
+  template <typename T, int capacity, class Codec = codec::None>
+  InPort<T, capacity, Codec> *makeInPort(std::string);
+
+  template <typename T, int capacity, class Codec = codec::None>
+  OutPort<T, capacity, Codec> *makeOutPort(std::string);
+
+  // An in port that may be connected to any number of out ports.
   template <typename T, int capacity>
-  InPort<T, capacity> *makeInPort(std::string);
+  FanInPort<T, capacity> *makeFanInPort(std::string);
 
+  // An out port that may be connected to any number of in ports of
+  // MulticastOutPort<T, capacity>::Payload.
   template <typename T, int capacity>
-  OutPort<T, capacity> *makeOutPort(std::string);
+  MulticastOutPort<T, capacity> *makeMulticastOutPort(std::string);
+
+  // An actor with firing rules is only invoked while at least one of them
+  // holds. Actors without rules are invoked on every scheduling round.
+  void addFiringRule(FiringRule rule);
 
 public:
-  template <class T> Actor(T &&name) : name(std::forward<T>(name)) {}
+  template <class T>
+  Actor(T &&name)
+      : name(std::forward<T>(name)), id(INVALID_ACTOR_ID), priority(0),
+        isPriorityFixed(false),
+        busyTime(0.0), schedulingState(SchedulingState::QUEUED),
+        executor(nullptr) {}
 
-  virtual ~Actor() = default;
+  virtual ~Actor();
 
   Actor(Actor &other) = delete;
 
@@ -60,30 +98,101 @@ public:
 
   std::string toString() const;
 
+  const std::string &getName() const { return name; }
+
+  // Dense ID of this actor among all actors of the graph, assigned by
+  // ActorGraph::synchronizeActors.
+  int getId() const { return id; }
+
   AbstractInPort *getInPort(const std::string &portName) const;
 
   AbstractOutPort *getOutPort(const std::string &portName) const;
 
+  // Ports are numbered densely in the order they were made.
+  size_t getInPortIndex(const std::string &portName) const;
+
+  AbstractInPort *getInPort(size_t index) const { return inPorts[index]; }
+
   virtual bool act() = 0;
 
+  // Invoked by the scheduler with a budget of up to that many firings. The
+  // default fires act() as long as the budget lasts and a firing rule
+  // holds. Actors can override it to drain several tokens at once with
+  // read_n and write_n. Returns true once the actor has finished.
+  virtual bool actBatch(size_t budget);
+
+  bool isReady() const;
+
+  // Ready actors with a higher priority are invoked first. Unless set
+  // explicitly, the priority is the number of remote connections of the
+  // actor's ports, which puts halo senders on the critical path first.
+  int getPriority() const { return priority; }
+
+  void setPriority(int priority);
+
+  // Asks the scheduler to re-evaluate the firing rules of this actor.
+  void trigger();
+
+  // Seconds spent in act() since the graph last rebalanced.
+  double getBusyTime() const { return busyTime; }
+
+  // Migration support. serialize() writes everything deserialize() needs
+  // to continue on an instance created by the factory registered with
+  // ActorGraph::registerActorType. Tokens buffered in the in ports are
+  // moved by the graph. Actors that do not override both cannot migrate.
+  virtual void serialize(archive::OutArchive &out) const;
+
+  virtual void deserialize(archive::InArchive &in);
+
 protected:
   std::string name;
 
 private:
-  std::unordered_map<std::string, AbstractInPort *> inPorts;
-  std::unordered_map<std::string, AbstractOutPort *> outPorts;
+  int id;
+
+  // Indexed by the port index, the position in which it was made.
+  std::vector<AbstractInPort *> inPorts;
+  std::vector<AbstractOutPort *> outPorts;
+  std::vector<FiringRule> firingRules;
+
+  int priority;
+  bool isPriorityFixed;
+
+  double busyTime;
+
+  std::atomic<SchedulingState> schedulingState;
+  WorkStealingExecutor *executor;
 };
 
+template <typename T, int capacity, class Codec>
+InPort<T, capacity, Codec> *Actor::makeInPort(std::string portName) {
+  auto ip = new InPort<T, capacity, Codec>(portName);
+  ip->owner = this;
+  inPorts.push_back(ip);
+  return ip;
+}
+
 template <typename T, int capacity>
-InPort<T, capacity> *Actor::makeInPort(std::string portName) {
-  auto ip = new InPort<T, capacity>(portName);
-  inPorts.emplace(portName, ip);
+FanInPort<T, capacity> *Actor::makeFanInPort(std::string portName) {
+  auto ip = new FanInPort<T, capacity>(portName);
+  ip->owner = this;
+  inPorts.push_back(ip);
   return ip;
 }
 
+template <typename T, int capacity, class Codec>
+OutPort<T, capacity, Codec> *Actor::makeOutPort(std::string portName) {
+  auto op = new OutPort<T, capacity, Codec>(portName);
+  op->owner = this;
+  outPorts.push_back(op);
+  return op;
+}
+
 template <typename T, int capacity>
-OutPort<T, capacity> *Actor::makeOutPort(std::string portName) {
-  auto op = new OutPort<T, capacity>(portName);
-  outPorts.emplace(portName, op);
+MulticastOutPort<T, capacity> *
+Actor::makeMulticastOutPort(std::string portName) {
+  auto op = new MulticastOutPort<T, capacity>(portName);
+  op->owner = this;
+  outPorts.push_back(op);
   return op;
 }
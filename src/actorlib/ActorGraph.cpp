@@ -26,7 +26,9 @@
  */
 
 #include "mpi.h"
+#include <algorithm>
 #include <chrono>
+#include <map>
 
 #include "ActorGraph.hpp"
 
@@ -35,128 +37,247 @@
 #include "Actor.hpp"
 #include "Channel.hpp"
 #include "PortIdentification.h"
+#include "WorkStealingExecutor.hpp"
 #include "utils/mpi_helper.hpp"
 
 using namespace std;
 
-void ActorGraph::addLocalActor(Actor *a) { localActors.emplace(a->name, a); }
+ActorGraph::ActorGraph(ExecutionConfiguration configuration)
+    : configuration(configuration), migrationTag(mpi::DEFAULT_TAG_ID) {
+  if (configuration.aggregateMessages)
+    progressEngine.enableAggregation(
+        configuration.aggregationBytes,
+        std::chrono::microseconds(
+            configuration.aggregationDelayMicroseconds));
+  if (configuration.useSharedMemory)
+    progressEngine.enableSharedMemory(configuration.sharedMemoryBytes);
+  if (configuration.useRma && mpi::world() > 1)
+    progressEngine.enableRma();
+  if (configuration.exchangeWithNeighbours &&
+      !configuration.aggregateMessages)
+    throw std::runtime_error("Exchanging with neighbours requires "
+                             "aggregateMessages.");
+}
+
+void ActorGraph::addLocalActor(Actor *a) { localActors.push_back(a); }
 
 void ActorGraph::synchronizeActors() {
   int worldSize = mpi::world();
 
-  // Exchange local number of actors
-  int *numActorsPerRank = (int *)malloc(sizeof(int) * worldSize);
-  int totalLocalActors = getNumActorsLocal();
-  MPI_Allgather(&totalLocalActors, 1, MPI_INT, numActorsPerRank, 1, MPI_INT,
-                MPI_COMM_WORLD);
-
-  int totalActors = 0;
-  for (int i = 0; i < worldSize; i++) {
-    totalActors += numActorsPerRank[i];
+  archive::OutArchive myActors;
+  for (auto actor : localActors) {
+    vector<string> inPortNames;
+    for (auto inPort : actor->inPorts)
+      inPortNames.push_back(inPort->getName());
+    myActors << actor->name << inPortNames;
   }
 
-  // Exchange Actors
-  // TODO: only int at the moment, need a user-defined data type
+  vector<int> sizePerRank(worldSize);
+  int mySize = static_cast<int>(myActors.data().size());
+  MPI_Allgather(&mySize, 1, MPI_INT, sizePerRank.data(), 1, MPI_INT,
+                progressEngine.communicator());
 
-  // Current map to flat array
-  int *myActors = (int *)malloc(sizeof(int) * getNumActorsLocal());
-  int myActorsIndex = 0;
-  for (std::pair<std::string, int> element : actors) {
-    myActors[myActorsIndex] = element.second;
-    myActorsIndex++;
-  }
+  vector<int> displacement(worldSize, 0);
+  for (int i = 1; i < worldSize; i++)
+    displacement[i] = displacement[i - 1] + sizePerRank[i - 1];
+
+  vector<char> globalActors(displacement.back() + sizePerRank.back());
+  MPI_Allgatherv(myActors.data().data(), mySize, MPI_BYTE,
+                 globalActors.data(), sizePerRank.data(), displacement.data(),
+                 MPI_BYTE, progressEngine.communicator());
 
-  int *displacement = (int *)malloc(sizeof(int) * worldSize);
-  displacement[0] = 0;
-  int currentIndex = 0;
-  for (int i = 1; i < worldSize; i++) {
-    displacement[i] = numActorsPerRank[i - 1] + currentIndex;
-    currentIndex = displacement[i];
+  // IDs and tags follow rank order, so every rank assigns the same.
+  long long nextTag = 0;
+  for (int i = 0; i < worldSize; i++) {
+    archive::InArchive in(globalActors.data() + displacement[i],
+                          sizePerRank[i]);
+    while (!in.isExhausted()) {
+      string actorName;
+      vector<string> inPortNames;
+      in >> actorName >> inPortNames;
+      this->checkInsert(actorName, i);
+      actors.back().firstInPortTag = static_cast<mpi::tag>(nextTag);
+      actors.back().inPortNames = std::move(inPortNames);
+      nextTag += actors.back().inPortNames.size();
+    }
   }
 
-  int *globalActors = (int *)malloc(sizeof(int) * totalActors);
-  MPI_Allgatherv(myActors, getNumActorsLocal(), MPI_INT, globalActors,
-                 numActorsPerRank, displacement, MPI_INT, MPI_COMM_WORLD);
+  int *tagUpperBound;
+  int hasTagUpperBound;
+  // The bound holds for every communicator, but is only attached to this one.
+  MPI_Comm_get_attr(MPI_COMM_WORLD, MPI_TAG_UB, &tagUpperBound,
+                    &hasTagUpperBound);
+  if (hasTagUpperBound && nextTag > *tagUpperBound)
+    throw std::runtime_error("The graph has more in ports than MPI tags.");
+  migrationTag = static_cast<mpi::tag>(nextTag);
 
-  for (int i = 0; i < totalActors; i++) {
-    this->checkInsert("Name not defined by mpi structure", globalActors[i]);
+  for (auto actor : localActors) {
+    actor->id = actorIds.at(actor->name);
+    actors[actor->id].localActor = actor;
   }
-
-  free(numActorsPerRank);
-  free(myActors);
-  free(displacement);
-  free(globalActors);
 }
 
 void ActorGraph::checkInsert(const string &actorName, int actorRank) {
-  if (this->actors.find(actorName) != this->actors.end())
+  if (this->actorIds.find(actorName) != this->actorIds.end())
     throw std::runtime_error("May not add actor that is already existing.");
-  this->actors.emplace(actorName, actorRank);
+  this->actorIds.emplace(actorName, static_cast<int>(actors.size()));
+  this->actors.push_back({actorName, actorRank, nullptr, 0, {}});
 }
 
 void ActorGraph::connectPorts(const string &sourceActorName,
                               const string &sourcePortName,
                               const string &destinationActorName,
-                              const string &destinationPortName) {
-  auto srcLocalActorIt = localActors.find(sourceActorName);
-  auto destLocalActorIt = localActors.find(destinationActorName);
+                              const string &destinationPortName,
+                              Transport transport) {
+  if (actors.empty())
+    throw std::runtime_error("Actors have to be synchronized before they are "
+                             "connected.");
 
-  if (destLocalActorIt == localActors.end() &&
-      srcLocalActorIt == localActors.end())
+  auto sourceActorId = getActorId(sourceActorName);
+  auto destinationActorId = getActorId(destinationActorName);
+  if (!actors[sourceActorId].localActor &&
+      !actors[destinationActorId].localActor)
     throw std::runtime_error("Cannot connect two external actors.");
 
-  if (destLocalActorIt != localActors.end()) {
+  // Both ranks lack the window alike, so they agree on the fallback.
+  if (transport == Transport::RMA && !progressEngine.hasWindow())
+    transport = Transport::MESSAGES;
+  connections.push_back({sourceActorId, sourcePortName, destinationActorId,
+                         destinationPortName, transport});
+  connect(connections.back());
+}
+
+void ActorGraph::connect(const Connection &connection) {
+  auto &source = actors[connection.sourceActorId];
+  auto &destination = actors[connection.destinationActorId];
+
+  if (source.localActor) {
+    // Source is Local
+    auto actorPtr = source.localActor;
+    auto srcOutPort = actorPtr->getOutPort(connection.sourcePortName);
+    srcOutPort->sendMessagesTo(identifyDestination(connection),
+                               &progressEngine);
+
+    // localToRemote
+    if (!destination.localActor)
+      countRemoteConnection(actorPtr);
+  }
+
+  if (destination.localActor) {
     // Destination is local
     // inPort || destinated Actor holds the channel
-    // It is responsible to warn writter when it has been read
-    Actor *actor = destLocalActorIt->second;
-    AbstractInPort *destInPort = actor->getInPort(destinationPortName);
-
-    if (srcLocalActorIt != localActors.end()) {
-      // localToLocal
-      AbstractOutPort *srcOutPort =
-          srcLocalActorIt->second->getOutPort(sourcePortName);
-      destInPort->receiveMessagesFrom(
-          PortIdentification<AbstractOutPort>(srcOutPort));
-    } else {
-      // remoteToLocal
-      auto actorIt = actors.find(sourceActorName);
-      if (actorIt == actors.end())
-        throw std::runtime_error("Cannot find source actor.");
-      destInPort->receiveMessagesFrom(
-          PortIdentification<AbstractOutPort>(sourcePortName, actorIt->second));
-    }
+    // It is responsible to warn writter when it has been read. A local
+    // source is attached to the channel already.
+    Actor *actor = destination.localActor;
+    AbstractInPort *destInPort =
+        actor->getInPort(connection.destinationPortName);
+    destInPort->receiveMessagesFrom(identifySource(connection),
+                                    &progressEngine);
+
+    // localToLocal or remoteToLocal
+    if (!source.localActor)
+      countRemoteConnection(actor);
   }
+}
 
-  if (srcLocalActorIt != localActors.end()) {
-    // Source is Local
-    auto actorPtr = srcLocalActorIt->second;
-    auto srcOutPort = actorPtr->getOutPort(sourcePortName);
-
-    if (destLocalActorIt != localActors.end()) {
-      // localToLocal
-      auto destInPort =
-          destLocalActorIt->second->getInPort(destinationPortName);
-      srcOutPort->sendMessagesTo(
-          PortIdentification<AbstractInPort>(destInPort));
-    } else {
-      // localToRemote
-      auto actorIt = actors.find(destinationActorName);
-      if (actorIt == actors.end())
-        throw std::runtime_error("Cannot find destined actor.");
-      srcOutPort->sendMessagesTo(PortIdentification<AbstractInPort>(
-          destinationPortName, actorIt->second));
-    }
+void ActorGraph::disconnect(const Connection &connection) {
+  auto source = actors[connection.sourceActorId].localActor;
+  if (source)
+    source->getOutPort(connection.sourcePortName)
+        ->disconnect(identifyDestination(connection));
+
+  auto destination = actors[connection.destinationActorId].localActor;
+  if (destination)
+    destination->getInPort(connection.destinationPortName)
+        ->disconnect(identifySource(connection));
+}
+
+PortIdentification<AbstractOutPort>
+ActorGraph::identifySource(const Connection &connection) const {
+  auto &source = actors[connection.sourceActorId];
+  if (source.localActor)
+    return PortIdentification<AbstractOutPort>(
+        source.localActor->getOutPort(connection.sourcePortName));
+
+  return PortIdentification<AbstractOutPort>(
+      connection.sourcePortName, source.rank,
+      getInPortTag(connection.destinationActorId,
+                   connection.destinationPortName),
+      connection.transport);
+}
+
+PortIdentification<AbstractInPort>
+ActorGraph::identifyDestination(const Connection &connection) const {
+  auto &destination = actors[connection.destinationActorId];
+  if (destination.localActor)
+    return PortIdentification<AbstractInPort>(
+        destination.localActor->getInPort(connection.destinationPortName));
+
+  return PortIdentification<AbstractInPort>(
+      connection.destinationPortName, destination.rank,
+      getInPortTag(connection.destinationActorId,
+                   connection.destinationPortName),
+      connection.transport);
+}
+
+mpi::tag ActorGraph::getInPortTag(int actorId, const string &portName) const {
+  auto &entry = actors[actorId];
+  auto portIt =
+      find(entry.inPortNames.begin(), entry.inPortNames.end(), portName);
+  if (portIt == entry.inPortNames.end())
+    throw std::runtime_error("Actor "s + entry.name +
+                             " has no InPort with id "s + portName);
+  return entry.firstInPortTag +
+         static_cast<mpi::tag>(portIt - entry.inPortNames.begin());
+}
+
+void ActorGraph::countRemoteConnection(Actor *actor) {
+  if (!actor->isPriorityFixed)
+    actor->priority++;
+}
+
+map<mpi::rank, int> ActorGraph::countRemotePeers(bool ofSources) const {
+  map<mpi::rank, int> peers;
+  for (auto &connection : connections) {
+    if (connection.transport != Transport::MESSAGES)
+      continue;
+    auto &source = actors[connection.sourceActorId];
+    auto &destination = actors[connection.destinationActorId];
+    if (ofSources && destination.localActor && !source.localActor)
+      peers[source.rank]++;
+    if (!ofSources && source.localActor && !destination.localActor)
+      peers[destination.rank]++;
+  }
+  return peers;
+}
+
+void ActorGraph::updatePriorities() {
+  for (auto actor : localActors) {
+    if (!actor->isPriorityFixed)
+      actor->priority = 0;
+  }
+
+  for (auto &connection : connections) {
+    auto source = actors[connection.sourceActorId].localActor;
+    auto destination = actors[connection.destinationActorId].localActor;
+    if (source && !destination)
+      countRemoteConnection(source);
+    if (destination && !source)
+      countRemoteConnection(destination);
   }
 }
 
 int ActorGraph::getNumActors() const { return actors.size(); }
 
-int ActorGraph::getNumActorsLocal() const { return actors.size(); }
+int ActorGraph::getNumActorsLocal() const { return localActors.size(); }
 
 mpi::rank ActorGraph::getActorByName(const std::string &name) const {
-  auto entry = actors.find(name);
-  if (entry != actors.end()) {
+  return actors[getActorId(name)].rank;
+}
+
+int ActorGraph::getActorId(const std::string &name) const {
+  auto entry = actorIds.find(name);
+  if (entry != actorIds.end()) {
     return entry->second;
   } else {
     throw std::runtime_error("unable to find actor named "s + name);
@@ -168,8 +289,8 @@ string ActorGraph::prettyPrint() const {
   ss << "ActorGraph {" << endl;
   ss << "  Actors {" << endl;
 
-  for (auto &kv : this->actors) {
-    ss << "    " << kv.first << "\t" << kv.second << endl;
+  for (auto &entry : this->actors) {
+    ss << "    " << entry.name << "\t" << entry.rank << endl;
   }
   ss << "  }" << endl;
   ss << "}";
@@ -177,26 +298,278 @@ string ActorGraph::prettyPrint() const {
 }
 
 double ActorGraph::run() {
-  MPI_Barrier(MPI_COMM_WORLD);
+  MPI_Barrier(progressEngine.communicator());
   auto start = std::chrono::steady_clock::now();
 
-  while (true) {
-    auto finished = 0;
-    for (auto actorPairs : localActors) {
-      if (actorPairs.second->act())
-        finished++;
-    }
-    if (finished == localActors.size())
-      break;
+  bool useProgressThread =
+      configuration.progressMode == ProgressMode::PROGRESS_THREAD;
+
+  // Ports call into MPI from the worker that runs their actor, and the
+  // ProgressEngine serializes these calls.
+  if ((configuration.workers() > 1 || useProgressThread) &&
+      mpi::threadLevel() < MPI_THREAD_SERIALIZED)
+    throw std::runtime_error("More than one worker or a progress thread "
+                             "requires MPI_THREAD_SERIALIZED.");
+
+  // Connections may have changed since the last run.
+  if (configuration.exchangeWithNeighbours)
+    progressEngine.exchangeWithNeighbours(countRemotePeers(true),
+                                          countRemotePeers(false));
+
+  for (auto actor : localActors) {
+    for (auto inPort : actor->inPorts)
+      inPort->grantCredits();
   }
 
-  MPI_Barrier(MPI_COMM_WORLD);
+  WorkStealingExecutor executor(localActors, configuration, &progressEngine);
+  executor.run();
+  if (configuration.exchangeWithNeighbours)
+    progressEngine.finishExchange();
+
+  MPI_Barrier(progressEngine.communicator());
   auto end = std::chrono::steady_clock::now();
 
+  if (migrationPolicy)
+    rebalance();
+
   return std::chrono::duration<double, std::ratio<1>>(end - start).count();
 }
 
+void ActorGraph::setMigrationPolicy(unique_ptr<MigrationPolicy> policy) {
+  migrationPolicy = std::move(policy);
+}
+
+void ActorGraph::rebalance() {
+  if (!migrationPolicy)
+    throw std::runtime_error("No migration policy set.");
+
+  int worldSize = mpi::world();
+  double myBusyTime = 0.0;
+  for (auto actor : localActors)
+    myBusyTime += actor->busyTime;
+
+  vector<double> busyTimePerRank(worldSize);
+  MPI_Allgather(&myBusyTime, 1, MPI_DOUBLE, busyTimePerRank.data(), 1,
+                MPI_DOUBLE, progressEngine.communicator());
+
+  // Every rank decides on its own actors, all ranks need all decisions.
+  archive::OutArchive myMigrations;
+  for (auto &migration :
+       migrationPolicy->selectMigrations(busyTimePerRank, localActors))
+    myMigrations << migration.actorName << migration.targetRank;
+
+  vector<int> sizePerRank(worldSize);
+  int mySize = static_cast<int>(myMigrations.data().size());
+  MPI_Allgather(&mySize, 1, MPI_INT, sizePerRank.data(), 1, MPI_INT,
+                progressEngine.communicator());
+
+  vector<int> displacement(worldSize, 0);
+  for (int i = 1; i < worldSize; i++)
+    displacement[i] = displacement[i - 1] + sizePerRank[i - 1];
+
+  vector<char> globalMigrations(displacement.back() + sizePerRank.back());
+  MPI_Allgatherv(myMigrations.data().data(), mySize, MPI_BYTE,
+                 globalMigrations.data(), sizePerRank.data(),
+                 displacement.data(), MPI_BYTE, progressEngine.communicator());
+
+  vector<Migration> migrations;
+  archive::InArchive in(globalMigrations.data(), globalMigrations.size());
+  while (!in.isExhausted()) {
+    Migration migration;
+    in >> migration.actorName >> migration.targetRank;
+    migrations.push_back(std::move(migration));
+  }
+
+  migrateActors(migrations);
+
+  for (auto actor : localActors)
+    actor->busyTime = 0.0;
+}
+
+void ActorGraph::migrateActors(const vector<Migration> &migrations) {
+  if (progressEngine.outstandingSends() > 0)
+    throw std::runtime_error("Cannot migrate actors while messages are in "
+                             "flight.");
+
+  map<int, mpi::rank> targets;
+  for (auto &migration : migrations) {
+    auto actorId = getActorId(migration.actorName);
+    if (actors[actorId].rank != migration.targetRank)
+      targets[actorId] = migration.targetRank;
+  }
+  if (targets.empty())
+    return;
+
+  auto isAffected = [&](const Connection &connection) {
+    return targets.count(connection.sourceActorId) > 0 ||
+           targets.count(connection.destinationActorId) > 0;
+  };
+
+  // No port may refer to an actor that is about to leave its rank.
+  for (auto &connection : connections) {
+    if (isAffected(connection))
+      disconnect(connection);
+  }
+
+  vector<vector<char>> packages;
+  vector<MPI_Request> requests;
+  packages.reserve(targets.size());
+  requests.reserve(targets.size());
+  int numIncoming = 0;
+  mpi::rank me = mpi::me();
+
+  for (auto &target : targets) {
+    if (target.second == me)
+      numIncoming++;
+
+    Actor *actor = actors[target.first].localActor;
+    if (!actor)
+      continue;
+
+    packages.push_back(packActor(actor));
+    requests.emplace_back();
+    MPI_Isend(packages.back().data(), static_cast<int>(packages.back().size()),
+              MPI_BYTE, target.second, migrationTag,
+              progressEngine.communicator(), &requests.back());
+    removeLocalActor(actor);
+  }
+
+  for (int i = 0; i < numIncoming; i++) {
+    MPI_Status status;
+    int size;
+    MPI_Probe(MPI_ANY_SOURCE, migrationTag, progressEngine.communicator(),
+              &status);
+    MPI_Get_count(&status, MPI_BYTE, &size);
+    vector<char> package(size);
+    MPI_Recv(package.data(), size, MPI_BYTE, status.MPI_SOURCE, migrationTag,
+             progressEngine.communicator(), MPI_STATUS_IGNORE);
+    unpackActor(package);
+  }
+
+  MPI_Waitall(static_cast<int>(requests.size()), requests.data(),
+              MPI_STATUSES_IGNORE);
+
+  for (auto &target : targets)
+    actors[target.first].rank = target.second;
+
+  for (auto &connection : connections) {
+    if (isAffected(connection))
+      connect(connection);
+  }
+  updatePriorities();
+}
+
+void ActorGraph::removeLocalActor(Actor *actor) {
+  actors[actor->id].localActor = nullptr;
+  localActors.erase(find(localActors.begin(), localActors.end(), actor));
+
+  // Actors added by the user stay with the user.
+  auto ownedIt = find_if(
+      migratedActors.begin(), migratedActors.end(),
+      [actor](const unique_ptr<Actor> &owned) { return owned.get() == actor; });
+  if (ownedIt != migratedActors.end())
+    migratedActors.erase(ownedIt);
+}
+
+vector<char> ActorGraph::packActor(Actor *actor) const {
+  string typeName = typeid(*actor).name();
+  if (actorFactories.find(typeName) == actorFactories.end())
+    throw std::runtime_error("Actor "s + actor->name +
+                             " has no registered type.");
+
+  archive::OutArchive state;
+  actor->serialize(state);
+
+  archive::OutArchive package;
+  bool hasFinished =
+      actor->schedulingState.load() == SchedulingState::FINISHED;
+  package << typeName << actor->id << state.data() << actor->priority
+          << actor->isPriorityFixed << hasFinished;
+
+  // Tokens are restored by port index.
+  package << actor->inPorts.size();
+  for (auto inPort : actor->inPorts) {
+    archive::OutArchive tokens;
+    inPort->saveTokens(tokens);
+    package << tokens.data();
+  }
+
+  vector<Connection> actorConnections;
+  for (auto &connection : connections) {
+    if (connection.sourceActorId == actor->id ||
+        connection.destinationActorId == actor->id)
+      actorConnections.push_back(connection);
+  }
+  package << actorConnections.size();
+  for (auto &connection : actorConnections)
+    package << connection.sourceActorId << connection.sourcePortName
+            << connection.destinationActorId << connection.destinationPortName
+            << connection.transport;
+
+  return package.data();
+}
+
+void ActorGraph::unpackActor(const vector<char> &package) {
+  archive::InArchive in(package.data(), package.size());
+
+  string typeName;
+  int actorId;
+  vector<char> state;
+  in >> typeName >> actorId >> state;
+
+  auto &entry = actors.at(actorId);
+  auto factoryIt = actorFactories.find(typeName);
+  if (factoryIt == actorFactories.end())
+    throw std::runtime_error("Actor "s + entry.name +
+                             " has no registered type.");
+
+  Actor *actor = factoryIt->second(entry.name);
+  migratedActors.emplace_back(actor);
+  actor->id = actorId;
+  archive::InArchive stateIn(state.data(), state.size());
+  actor->deserialize(stateIn);
+  bool hasFinished;
+  in >> actor->priority >> actor->isPriorityFixed >> hasFinished;
+  if (hasFinished)
+    actor->schedulingState.store(SchedulingState::FINISHED);
+
+  size_t numInPorts;
+  in >> numInPorts;
+  if (numInPorts != actor->inPorts.size())
+    throw std::runtime_error("Actor "s + entry.name +
+                             " was recreated with different ports.");
+  for (size_t index = 0; index < numInPorts; index++) {
+    vector<char> tokens;
+    in >> tokens;
+    archive::InArchive tokensIn(tokens.data(), tokens.size());
+    actor->getInPort(index)->restoreTokens(tokensIn);
+  }
+
+  size_t numConnections;
+  in >> numConnections;
+  for (size_t i = 0; i < numConnections; i++) {
+    Connection connection;
+    in >> connection.sourceActorId >> connection.sourcePortName >>
+        connection.destinationActorId >> connection.destinationPortName >>
+        connection.transport;
+    bool isKnown = any_of(
+        connections.begin(), connections.end(), [&](const Connection &other) {
+          return other.sourceActorId == connection.sourceActorId &&
+                 other.sourcePortName == connection.sourcePortName &&
+                 other.destinationActorId == connection.destinationActorId &&
+                 other.destinationPortName == connection.destinationPortName;
+        });
+    if (!isKnown)
+      connections.push_back(std::move(connection));
+  }
+
+  localActors.push_back(actor);
+  entry.localActor = actor;
+}
+
 ActorGraph::~ActorGraph() {
   actors.clear();
+  actorIds.clear();
   localActors.clear();
+  migratedActors.clear();
 }
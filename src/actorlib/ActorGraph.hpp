@@ -26,11 +26,18 @@
  */
 
 #include "utils/mpi_helper.hpp"
+#include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
+#include <typeinfo>
 #include <unordered_map>
+#include <vector>
 
 #include "Actor.hpp"
+#include "ExecutionConfiguration.hpp"
+#include "MigrationPolicy.hpp"
+#include "ProgressEngine.hpp"
 
 #pragma once
 
@@ -39,11 +46,46 @@ class ActorGraph {
   friend class Actor;
 
 private:
-  std::unordered_map<std::string, mpi::rank> actors;
-  std::unordered_map<std::string, Actor *> localActors;
+  struct ActorEntry {
+    std::string name;
+    mpi::rank rank;
+    // Only set for actors on this rank.
+    Actor *localActor;
+    // Tag of the first in port, the others follow in port index order.
+    mpi::tag firstInPortTag;
+    std::vector<std::string> inPortNames;
+  };
+
+  struct Connection {
+    int sourceActorId;
+    std::string sourcePortName;
+    int destinationActorId;
+    std::string destinationPortName;
+    Transport transport;
+  };
+
+  // Indexed by actor ID.
+  std::vector<ActorEntry> actors;
+  // Names are only resolved during setup.
+  std::unordered_map<std::string, int> actorIds;
+  // Handed to the executor as is.
+  std::vector<Actor *> localActors;
+  ExecutionConfiguration configuration;
+  ProgressEngine progressEngine;
+
+  // Every connection with a local endpoint, to rewire them on migration.
+  std::vector<Connection> connections;
+  std::unordered_map<std::string, std::function<Actor *(const std::string &)>>
+      actorFactories;
+  std::unique_ptr<MigrationPolicy> migrationPolicy;
+  // Actors created here when they migrated in.
+  std::vector<std::unique_ptr<Actor>> migratedActors;
+  // One past the tags of all in ports.
+  mpi::tag migrationTag;
 
 public:
-  ActorGraph() = default;
+  explicit ActorGraph(
+      ExecutionConfiguration configuration = ExecutionConfiguration());
 
   ~ActorGraph();
 
@@ -53,14 +95,21 @@ public:
 
   ActorGraph &operator=(ActorGraph &other) = delete;
 
+  // The caller keeps ownership of a, also after it migrated away.
   void addLocalActor(Actor *a);
 
+  // Collective. Assigns every actor of the graph a dense ID and every in
+  // port the tag of its messages. Has to precede connectPorts.
   void synchronizeActors();
 
+  // The transport only applies if the actors are on different ranks, and
+  // has to be the same on both. Transport::RMA falls back to messages
+  // unless ExecutionConfiguration::useRma created the window.
   void connectPorts(const std::string &sourceActorName,
                     const std::string &sourcePortName,
                     const std::string &destinationActorName,
-                    const std::string &destinationPortName);
+                    const std::string &destinationPortName,
+                    Transport transport = Transport::MESSAGES);
 
   int getNumActors() const;
 
@@ -68,10 +117,66 @@ public:
 
   mpi::rank getActorByName(const std::string &name) const;
 
+  int getActorId(const std::string &name) const;
+
   std::string prettyPrint() const;
 
+  // Runs the graph until global termination. If a migration policy is set,
+  // the graph rebalances afterwards.
   double run();
 
+  // Registers how instances of ActorType are created on the target rank of
+  // a migration. Has to be done on every rank.
+  template <class ActorType>
+  void registerActorType(
+      std::function<ActorType *(const std::string &actorName)> create);
+
+  void setMigrationPolicy(std::unique_ptr<MigrationPolicy> policy);
+
+  // Collective. Moves the given actors to their target ranks, together with
+  // the tokens buffered in their in ports, and rewires all their
+  // connections. Has to be called by every rank with the same migrations
+  // while no message is in flight, e.g. between two runs. Actors that
+  // finished stay finished. Instances created here for actors that migrated
+  // in are deleted when they leave again.
+  void migrateActors(const std::vector<Migration> &migrations);
+
+  // Collective. Lets the migration policy decide on migrations from the
+  // busy time of every rank and performs them.
+  void rebalance();
+
 private:
   void checkInsert(const std::string &actorName, int actorRank);
+
+  mpi::tag getInPortTag(int actorId, const std::string &portName) const;
+
+  void removeLocalActor(Actor *actor);
+
+  void connect(const Connection &connection);
+
+  void disconnect(const Connection &connection);
+
+  PortIdentification<AbstractOutPort>
+  identifySource(const Connection &connection) const;
+
+  PortIdentification<AbstractInPort>
+  identifyDestination(const Connection &connection) const;
+
+  void countRemoteConnection(Actor *actor);
+
+  // Number of message connections by remote rank, of the remote sources of
+  // local actors or of the remote destinations.
+  std::map<mpi::rank, int> countRemotePeers(bool ofSources) const;
+
+  void updatePriorities();
+
+  std::vector<char> packActor(Actor *actor) const;
+
+  void unpackActor(const std::vector<char> &package);
 };
+
+template <class ActorType>
+void ActorGraph::registerActorType(
+    std::function<ActorType *(const std::string &actorName)> create) {
+  actorFactories[typeid(ActorType).name()] = std::move(create);
+}
@@ -25,11 +25,11 @@
  *
  *
  */
-
 #include <array>
-#include <iostream>
-#include <memory>
-#include <queue>
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
 
 #pragma once
 
@@ -37,78 +37,190 @@ class AbstractInPort;
 
 class AbstractOutPort;
 
+// Single-producer single-consumer ring buffer. The producer reserves slots,
+// fills them in place and commits them in reservation order. The consumer
+// takes committed elements from the front. Producer and consumer may run on
+// different threads, but each side has to be used by one thread at a time.
 template <typename T, int capacity> class Channel {
 
 private:
-  int lastElement;
-  int firstElement;
-  bool isFull;
+  static constexpr size_t CACHE_LINE_SIZE = 64;
+
+  static constexpr size_t roundUpToPowerOfTwo(size_t value) {
+    return value <= 1 ? 1 : 2 * roundUpToPowerOfTwo((value + 1) / 2);
+  }
 
-  std::array<T, capacity> buffer;
+  static constexpr size_t SLOTS = roundUpToPowerOfTwo(capacity);
+  static constexpr size_t MASK = SLOTS - 1;
 
-  std::queue<T *> elements;
-  std::queue<T *> freeSpace;
+  std::array<T, SLOTS> buffer;
+
+  // Every index grows monotonically and is only masked on access. The
+  // padding keeps the consumer and producer indices on separate lines.
+  char padBefore[CACHE_LINE_SIZE];
+  // Next element to be taken, written by the consumer.
+  std::atomic<size_t> head;
+  char padHead[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+  // One past the last committed element, written by the producer.
+  std::atomic<size_t> tail;
+  // One past the last reserved slot, written by the producer.
+  std::atomic<size_t> reserved;
+  char padTail[CACHE_LINE_SIZE - 2 * sizeof(std::atomic<size_t>)];
 
 public:
   Channel();
 
+  // Number of slots, the capacity rounded up to a power of two.
+  static constexpr size_t slots() { return SLOTS; }
+
+  // Position of a slot in the ring, stable for the lifetime of the channel.
+  size_t indexOf(const T *element) const {
+    return static_cast<size_t>(element - buffer.data());
+  }
+
+  // The memory of all slots, for transports that fill them remotely.
+  T *data() { return buffer.data(); }
+
+  // Position of the slot the next reserve() returns.
+  size_t nextIndex() const {
+    return reserved.load(std::memory_order_relaxed) & MASK;
+  }
+
+  // Producer side.
   T *reserve();
 
-  void returnElement(T *);
+  // Elements are committed in the order they were reserved.
+  void commit(T *element);
+
+  // Hands back all reserved slots that were not committed yet.
+  void cancelReservations();
 
+  // Bulk variant of reserve and commit, publishing count elements at once.
+  template <class InputIt> InputIt putNext(InputIt source, size_t count);
+
+  // Consumer side.
   T getNext();
 
+  template <class OutputIt>
+  OutputIt getNext(OutputIt destination, size_t count);
+
   T peek() const;
 
+  // The first element in its slot, which is kept until popFront().
+  T *front();
+
+  void popFront();
+
   size_t available() const;
+
+  size_t freeCapacity() const;
 };
 
 template <typename T, int capacity>
-Channel<T, capacity>::Channel()
-    : lastElement(0), firstElement(0), isFull(false) {
-  for (auto &el : buffer) {
-    freeSpace.push(&el);
-  }
+Channel<T, capacity>::Channel() : head(0), tail(0), reserved(0) {
+  static_assert(capacity > 0, "Channels need a capacity of at least one.");
+}
+
+template <typename T, int capacity> T *Channel<T, capacity>::reserve() {
+  auto slot = reserved.load(std::memory_order_relaxed);
+  if (slot - head.load(std::memory_order_acquire) >= capacity)
+    throw std::runtime_error("Channel is full");
+
+  reserved.store(slot + 1, std::memory_order_relaxed);
+  return &buffer[slot & MASK];
 }
 
 template <typename T, int capacity>
-void Channel<T, capacity>::returnElement(T *element) {
-  if (elements.size() >= capacity)
-    throw std::runtime_error("Cannot emplace a previously reserved element.");
+void Channel<T, capacity>::commit(T *element) {
+  auto last = tail.load(std::memory_order_relaxed);
+  if (last == reserved.load(std::memory_order_relaxed) ||
+      element != &buffer[last & MASK])
+    throw std::runtime_error("Elements have to be committed in the order "
+                             "they were reserved.");
+
+  tail.store(last + 1, std::memory_order_release);
+}
 
-  elements.push(element);
+template <typename T, int capacity>
+void Channel<T, capacity>::cancelReservations() {
+  reserved.store(tail.load(std::memory_order_relaxed),
+                 std::memory_order_relaxed);
 }
 
-template <typename T, int capacity> T *Channel<T, capacity>::reserve() {
-  if (freeSpace.empty())
+template <typename T, int capacity>
+template <class InputIt>
+InputIt Channel<T, capacity>::putNext(InputIt source, size_t count) {
+  auto last = tail.load(std::memory_order_relaxed);
+  if (last != reserved.load(std::memory_order_relaxed))
+    throw std::runtime_error("Cannot put elements while slots are reserved.");
+  if (last + count - head.load(std::memory_order_acquire) > capacity)
     throw std::runtime_error("Channel is full");
 
-  T *firstFree = freeSpace.front();
-  freeSpace.pop();
-  return firstFree;
+  for (size_t i = 0; i < count; i++, ++source)
+    buffer[(last + i) & MASK] = *source;
+
+  reserved.store(last + count, std::memory_order_relaxed);
+  tail.store(last + count, std::memory_order_release);
+  return source;
 }
 
 template <typename T, int capacity> T Channel<T, capacity>::getNext() {
-  if (elements.empty())
+  auto first = head.load(std::memory_order_relaxed);
+  if (first == tail.load(std::memory_order_acquire))
     throw std::runtime_error("Channel is empty");
 
-  T *elementAddress = elements.front();
-  T element = *elements.front();
+  T element = std::move(buffer[first & MASK]);
+  head.store(first + 1, std::memory_order_release);
+  return element;
+}
 
-  elements.pop();
-  freeSpace.push(elementAddress);
+template <typename T, int capacity>
+template <class OutputIt>
+OutputIt Channel<T, capacity>::getNext(OutputIt destination, size_t count) {
+  auto first = head.load(std::memory_order_relaxed);
+  if (tail.load(std::memory_order_acquire) - first < count)
+    throw std::runtime_error("Channel is empty");
 
-  return element;
+  for (size_t i = 0; i < count; i++, ++destination)
+    *destination = std::move(buffer[(first + i) & MASK]);
+
+  head.store(first + count, std::memory_order_release);
+  return destination;
 }
 
 template <typename T, int capacity> T Channel<T, capacity>::peek() const {
-  if (elements.empty())
+  auto first = head.load(std::memory_order_relaxed);
+  if (first == tail.load(std::memory_order_acquire))
     throw std::runtime_error("Channel is empty");
 
-  return *elements.front();
+  return buffer[first & MASK];
+}
+
+template <typename T, int capacity> T *Channel<T, capacity>::front() {
+  auto first = head.load(std::memory_order_relaxed);
+  if (first == tail.load(std::memory_order_acquire))
+    throw std::runtime_error("Channel is empty");
+
+  return &buffer[first & MASK];
+}
+
+template <typename T, int capacity> void Channel<T, capacity>::popFront() {
+  auto first = head.load(std::memory_order_relaxed);
+  if (first == tail.load(std::memory_order_acquire))
+    throw std::runtime_error("Channel is empty");
+
+  head.store(first + 1, std::memory_order_release);
 }
 
 template <typename T, int capacity>
 size_t Channel<T, capacity>::available() const {
-  return elements.size();
+  // The head never passes the tail, so it is read first.
+  auto first = head.load(std::memory_order_acquire);
+  return tail.load(std::memory_order_acquire) - first;
+}
+
+template <typename T, int capacity>
+size_t Channel<T, capacity>::freeCapacity() const {
+  auto first = head.load(std::memory_order_acquire);
+  return capacity - (reserved.load(std::memory_order_acquire) - first);
 }
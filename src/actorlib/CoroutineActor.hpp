@@ -0,0 +1,152 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Actors whose behaviour is a single coroutine. The coroutine suspends on
+ * port operations that cannot complete yet, and the scheduler resumes it
+ * only once the awaited condition holds. Requires C++20; the header is
+ * empty for older standards.
+ */
+
+#include "Actor.hpp"
+#include "FiringRule.hpp"
+#include "InPort.hpp"
+#include "OutPort.hpp"
+
+#pragma once
+
+#if defined(__cpp_impl_coroutine)
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <utility>
+
+class CoroutineActor : public Actor {
+public:
+  class Behaviour {
+  public:
+    struct promise_type {
+      Behaviour get_return_object() {
+        return Behaviour(
+            std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+
+      // The body starts on the first invocation by the scheduler.
+      std::suspend_always initial_suspend() noexcept { return {}; }
+
+      // Keeps the frame alive, so that act() can observe completion.
+      std::suspend_always final_suspend() noexcept { return {}; }
+
+      void return_void() {}
+
+      void unhandled_exception() { error = std::current_exception(); }
+
+      std::exception_ptr error;
+    };
+
+    explicit Behaviour(std::coroutine_handle<promise_type> handle)
+        : handle(handle) {}
+
+    Behaviour(Behaviour &&other) noexcept
+        : handle(std::exchange(other.handle, nullptr)) {}
+
+    Behaviour(const Behaviour &) = delete;
+    Behaviour &operator=(const Behaviour &) = delete;
+    Behaviour &operator=(Behaviour &&) = delete;
+
+    ~Behaviour() {
+      if (handle)
+        handle.destroy();
+    }
+
+  private:
+    friend class CoroutineActor;
+
+    std::coroutine_handle<promise_type> handle;
+  };
+
+  template <class str>
+  explicit CoroutineActor(str &&name) : Actor(std::forward<str>(name)) {
+    addFiringRule(
+        FiringRule().guard([this]() { return awaited.isSatisfied(); }));
+  }
+
+  bool act() final {
+    if (!behaviour)
+      behaviour.reset(new Behaviour(body()));
+
+    awaited = FiringRule();
+    behaviour->handle.resume();
+
+    auto &promise = behaviour->handle.promise();
+    if (promise.error)
+      std::rethrow_exception(std::exchange(promise.error, nullptr));
+    return behaviour->handle.done();
+  }
+
+protected:
+  // The body of the actor. Returning from it finishes the actor.
+  virtual Behaviour body() = 0;
+
+  // co_await read(port) yields the next token of port.
+  template <typename T, int capacity, class Codec>
+  auto read(InPort<T, capacity, Codec> *port) {
+    struct Awaiter {
+      bool await_ready() const { return port->available() > 0; }
+      void await_suspend(std::coroutine_handle<>) {
+        actor->awaited = FiringRule().consume(port);
+      }
+      T await_resume() { return port->read(); }
+
+      CoroutineActor *actor;
+      InPort<T, capacity, Codec> *port;
+    };
+    return Awaiter{this, port};
+  }
+
+  // co_await write(port, element) writes element once port has room.
+  template <typename T, int capacity, class Codec, typename E>
+  auto write(OutPort<T, capacity, Codec> *port, E &&element) {
+    struct Awaiter {
+      bool await_ready() const { return port->freeCapacity() > 0; }
+      void await_suspend(std::coroutine_handle<>) {
+        actor->awaited = FiringRule().produce(port);
+      }
+      void await_resume() { port->write(std::move(element)); }
+
+      CoroutineActor *actor;
+      OutPort<T, capacity, Codec> *port;
+      T element;
+    };
+    return Awaiter{this, port, T(std::forward<E>(element))};
+  }
+
+  // co_await suspend() hands the worker back to the scheduler, the actor
+  // is resumed in a later round.
+  std::suspend_always suspend() { return {}; }
+
+private:
+  std::unique_ptr<Behaviour> behaviour;
+  FiringRule awaited;
+};
+
+#endif
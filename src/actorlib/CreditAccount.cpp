@@ -0,0 +1,96 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include <algorithm>
+
+#include "AbstractOutPort.hpp"
+#include "CreditAccount.hpp"
+
+using namespace std;
+
+CreditAccount::CreditAccount(ProgressEngine *progressEngine, mpi::rank peer,
+                             mpi::tag messageTag)
+    : progressEngine(progressEngine), peer(peer), messageTag(messageTag),
+      credits(0), overdraft(0), grant(0), isOpen(true) {
+  expectGrant();
+}
+
+size_t CreditAccount::available() const {
+  auto balance = credits.load(memory_order_acquire);
+  return balance > 0 ? static_cast<size_t>(balance) : 0;
+}
+
+bool CreditAccount::tryConsume(size_t count) {
+  auto wanted = static_cast<long long>(count);
+  auto balance = credits.load(memory_order_acquire);
+  do {
+    if (balance + overdraft.load(memory_order_relaxed) < wanted)
+      return false;
+  } while (!credits.compare_exchange_weak(balance, balance - wanted,
+                                          memory_order_acq_rel));
+  return true;
+}
+
+void CreditAccount::refund(size_t count) {
+  credits.fetch_add(static_cast<long long>(count), memory_order_release);
+  // Other ports may have found the account empty in the meantime.
+  lock_guard<mutex> lock(subscriberMutex);
+  notifySubscribers();
+}
+
+void CreditAccount::subscribe(const AbstractOutPort *port) {
+  lock_guard<mutex> lock(subscriberMutex);
+  subscribers.push_back(port);
+  overdraft.store(static_cast<long long>(subscribers.size()) - 1);
+}
+
+bool CreditAccount::unsubscribe(const AbstractOutPort *port) {
+  lock_guard<mutex> lock(subscriberMutex);
+  subscribers.erase(remove(subscribers.begin(), subscribers.end(), port),
+                    subscribers.end());
+  isOpen = !subscribers.empty();
+  overdraft.store(isOpen ? static_cast<long long>(subscribers.size()) - 1
+                         : 0);
+  return isOpen;
+}
+
+void CreditAccount::onRequestCompleted(size_t) {
+  credits.fetch_add(static_cast<long long>(grant), memory_order_release);
+
+  lock_guard<mutex> lock(subscriberMutex);
+  if (isOpen)
+    expectGrant();
+  notifySubscribers();
+}
+
+void CreditAccount::notifySubscribers() {
+  for (auto port : subscribers)
+    port->notifyOwner();
+}
+
+void CreditAccount::expectGrant() {
+  auto transfer = mpi::makeReceive(peer, messageTag, &grant);
+  transfer.isControl = true;
+  progressEngine->submit(transfer, this, 0);
+}
@@ -0,0 +1,88 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Sender side of the credit-based flow control between ranks.
+ */
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "ProgressEngine.hpp"
+#include "utils/mpi_helper.hpp"
+
+#pragma once
+
+class AbstractOutPort;
+
+// Credits a remote InPort has granted to this rank. A sender may only send
+// as many tokens as it holds credits, and the receiver grants credits for
+// the room in its channel and returns them as its actor consumes tokens.
+// Senders on one rank that write to the same port share one account, as
+// the receiver cannot tell them apart. A port of a shared account may find
+// the credits it checked taken by another one, so shared accounts allow an
+// overdraft of one token for every port beyond the first. The receiver
+// buffers these tokens until its channel has room. Accounts of a single
+// port never go below zero.
+class CreditAccount : public RequestHandler {
+public:
+  CreditAccount(ProgressEngine *progressEngine, mpi::rank peer,
+                mpi::tag messageTag);
+
+  CreditAccount(CreditAccount &other) = delete;
+
+  CreditAccount &operator=(CreditAccount &other) = delete;
+
+  size_t available() const;
+
+  // Takes count credits, unless that would exceed the overdraft.
+  bool tryConsume(size_t count);
+
+  // Returns credits taken by tryConsume for tokens that were not sent.
+  void refund(size_t count);
+
+  // Subscribed ports have their owner notified when credits arrive.
+  void subscribe(const AbstractOutPort *port);
+
+  // Returns whether any port is still subscribed. Without subscribers, the
+  // account stops expecting grants.
+  bool unsubscribe(const AbstractOutPort *port);
+
+  void onRequestCompleted(size_t slot) final;
+
+private:
+  void expectGrant();
+
+  void notifySubscribers();
+
+  ProgressEngine *progressEngine;
+  mpi::rank peer;
+  mpi::tag messageTag;
+
+  std::atomic<long long> credits;
+  std::atomic<long long> overdraft;
+  unsigned long long grant;
+
+  std::mutex subscriberMutex;
+  std::vector<const AbstractOutPort *> subscribers;
+  bool isOpen;
+};
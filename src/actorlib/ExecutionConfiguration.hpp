@@ -0,0 +1,105 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Run-time options that select how an ActorGraph executes its local actors.
+ */
+
+#include <cstddef>
+
+#pragma once
+
+enum class ExecutionMode {
+  // All local actors are run on the thread that calls ActorGraph::run().
+  SEQUENTIAL,
+  // A pool of worker threads with per-worker deques and work stealing.
+  WORK_STEALING
+};
+
+enum class ProgressMode {
+  // Workers test outstanding remote requests between actor invocations.
+  SCHEDULER_PASS,
+  // A dedicated thread tests outstanding remote requests.
+  PROGRESS_THREAD
+};
+
+enum class IdlePolicy {
+  // Keep polling for ready actors and remote completions.
+  SPIN,
+  // Yield the core between polls.
+  YIELD,
+  // Park on a condition variable until an actor becomes ready. Once every
+  // worker is parked, one thread blocks in MPI_Waitsome instead.
+  BLOCK
+};
+
+struct ExecutionConfiguration {
+  ExecutionMode mode = ExecutionMode::SEQUENTIAL;
+
+  // Number of worker threads per rank in ExecutionMode::WORK_STEALING,
+  // including the thread that calls ActorGraph::run().
+  unsigned int numberOfWorkers = 1;
+
+  // All MPI calls of ports are serialized by the ProgressEngine. More than
+  // one worker or a progress thread thus requires MPI_THREAD_SERIALIZED.
+  ProgressMode progressMode = ProgressMode::SCHEDULER_PASS;
+
+  // Applied by workers and the progress thread after the given number of
+  // consecutive passes without any ready actor or completed request.
+  IdlePolicy idlePolicy = IdlePolicy::YIELD;
+  unsigned int emptyPassesBeforeIdle = 100;
+
+  // Budget passed to Actor::actBatch, the number of firings an actor may
+  // perform per scheduling round.
+  unsigned int batchSize = 1;
+
+  // Opt-in. Packs the messages of all ports bound for the same rank into
+  // one MPI message. A batch is sent once it holds aggregationBytes, once
+  // its oldest message has waited aggregationDelayMicroseconds, or once a
+  // worker runs out of ready actors. Has to be the same on all ranks.
+  bool aggregateMessages = false;
+  size_t aggregationBytes = 64 * 1024;
+  unsigned int aggregationDelayMicroseconds = 50;
+
+  // Opt-in, requires aggregateMessages. The batches of ranks connected by
+  // ports are exchanged in rounds of MPI neighbourhood collectives over a
+  // graph of these ranks instead of being sent one by one. Every rank takes
+  // part in every round, a round starts at the latest
+  // aggregationDelayMicroseconds after the previous one. Ranks on the same
+  // node still use shared memory. Has to be the same on all ranks.
+  bool exchangeWithNeighbours = false;
+
+  // Messages between ranks on the same node are copied through a mailbox
+  // of sharedMemoryBytes in shared memory instead of being sent with MPI.
+  // Messages larger than a quarter of it only pass their header through
+  // the mailbox. Has to be the same on all ranks.
+  bool useSharedMemory = true;
+  size_t sharedMemoryBytes = 64 * 1024;
+
+  // Opt-in. Creates the window that connections with Transport::RMA put
+  // their tokens into. Without it, or on a single rank, such connections
+  // send messages instead. Has to be the same on all ranks.
+  bool useRma = false;
+
+  unsigned int workers() const {
+    return mode == ExecutionMode::WORK_STEALING ? numberOfWorkers : 1;
+  }
+};
@@ -0,0 +1,342 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Bounded multi-producer single-consumer ring used by FanInPort.
+ */
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <list>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+#pragma once
+
+// Multi-producer single-consumer ring buffer, the channel of a FanInPort.
+// Every slot carries a sequence number, so that producers may fill and
+// commit the slots they reserved concurrently and in any order. The
+// consumer takes slots in reservation order once they are committed.
+//
+// Producers attach to the channel and write through their handle. The
+// capacity is divided among them by weight, so that a producer that found
+// free capacity still has it when it writes, regardless of the others.
+template <typename T, int capacity> class FanInChannel {
+
+public:
+  class Producer {
+    friend class FanInChannel;
+
+  public:
+    explicit Producer(FanInChannel *channel)
+        : channel(channel), weight(0), quota(0), used(0) {}
+
+    T *reserve();
+
+    void commit(T *element);
+
+    template <class InputIt> InputIt putNext(InputIt source, size_t count);
+
+    // Capacity only, an element is stored later with push().
+    bool acquireCredit();
+
+    void releaseCredit();
+
+    void push(T &&element);
+
+    size_t freeCapacity() const;
+
+    size_t getQuota() const { return quota; }
+
+  private:
+    FanInChannel *channel;
+    size_t weight;
+    size_t quota;
+    std::atomic<size_t> used;
+  };
+
+private:
+  static constexpr size_t CACHE_LINE_SIZE = 64;
+
+  static constexpr size_t roundUpToPowerOfTwo(size_t value) {
+    return value <= 1 ? 1 : 2 * roundUpToPowerOfTwo((value + 1) / 2);
+  }
+
+  static constexpr size_t SLOTS = roundUpToPowerOfTwo(capacity);
+  static constexpr size_t MASK = SLOTS - 1;
+
+  std::array<T, SLOTS> buffer;
+  std::array<Producer *, SLOTS> owners;
+  // A free slot holds the position it is reserved for next, a committed
+  // slot that position plus one.
+  std::array<std::atomic<size_t>, SLOTS> sequence;
+
+  char padBefore[CACHE_LINE_SIZE];
+  // Next position to be taken, written by the consumer.
+  std::atomic<size_t> head;
+  char padHead[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+  // Next position to be reserved, shared by the producers.
+  std::atomic<size_t> tail;
+  char padTail[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+  // Slots and credits that are in use, bounded by the capacity.
+  std::atomic<size_t> used;
+  // Committed elements, including the ones taken already.
+  std::atomic<size_t> committed;
+  char padUsed[CACHE_LINE_SIZE - 2 * sizeof(std::atomic<size_t>)];
+
+  // Detached producers are kept, their elements may still be queued.
+  std::list<Producer> producers;
+
+  T *claim(Producer *owner);
+
+  void publish(T *element);
+
+  void updateQuotas();
+
+  // Waits for a producer that reserved the first slot before a later one
+  // was committed. Only lasts for the duration of a single write.
+  size_t awaitFirst() const;
+
+public:
+  FanInChannel();
+
+  // Attaching and detaching must not overlap with writes.
+  Producer *attach(size_t weight = 1);
+
+  void setWeight(Producer *producer, size_t weight);
+
+  void detach(Producer *producer) { setWeight(producer, 0); }
+
+  // Stores an element outside of any quota, used to restore tokens.
+  void restore(T &&element);
+
+  // Consumer side.
+  T getNext();
+
+  // Also tells which producer wrote the element, nullptr for restored ones.
+  T getNext(Producer **owner);
+
+  template <class OutputIt>
+  OutputIt getNext(OutputIt destination, size_t count);
+
+  T peek() const;
+
+  // The first element in its slot, which is kept until popFront().
+  T *front();
+
+  void popFront(Producer **owner);
+
+  size_t available() const;
+};
+
+template <typename T, int capacity>
+FanInChannel<T, capacity>::FanInChannel()
+    : head(0), tail(0), used(0), committed(0) {
+  static_assert(capacity > 0, "Channels need a capacity of at least one.");
+  for (size_t i = 0; i < SLOTS; i++)
+    sequence[i].store(i, std::memory_order_relaxed);
+}
+
+template <typename T, int capacity>
+typename FanInChannel<T, capacity>::Producer *
+FanInChannel<T, capacity>::attach(size_t weight) {
+  auto producer = std::find_if(
+      producers.begin(), producers.end(), [](const Producer &candidate) {
+        return candidate.weight == 0 && candidate.used.load() == 0;
+      });
+  if (producer == producers.end()) {
+    producers.emplace_back(this);
+    producer = std::prev(producers.end());
+  }
+  setWeight(&*producer, weight);
+  return &*producer;
+}
+
+template <typename T, int capacity>
+void FanInChannel<T, capacity>::setWeight(Producer *producer, size_t weight) {
+  producer->weight = weight;
+  updateQuotas();
+}
+
+template <typename T, int capacity>
+void FanInChannel<T, capacity>::updateQuotas() {
+  size_t totalWeight = 0;
+  for (auto &producer : producers)
+    totalWeight += producer.weight;
+  if (totalWeight > capacity)
+    throw std::runtime_error("Channel capacity is smaller than its number of "
+                             "sources.");
+
+  for (auto &producer : producers)
+    producer.quota = totalWeight ? capacity * producer.weight / totalWeight : 0;
+}
+
+template <typename T, int capacity>
+T *FanInChannel<T, capacity>::claim(Producer *owner) {
+  // Capacity is acquired first, so the consumer has already taken or is
+  // about to take the element at this position from the previous round.
+  auto position = tail.fetch_add(1, std::memory_order_relaxed);
+  while (sequence[position & MASK].load(std::memory_order_acquire) !=
+         position)
+    std::this_thread::yield();
+  owners[position & MASK] = owner;
+  return &buffer[position & MASK];
+}
+
+template <typename T, int capacity>
+void FanInChannel<T, capacity>::publish(T *element) {
+  auto index = static_cast<size_t>(element - buffer.data());
+  auto position = sequence[index].load(std::memory_order_relaxed);
+  sequence[index].store(position + 1, std::memory_order_release);
+  committed.fetch_add(1, std::memory_order_release);
+}
+
+template <typename T, int capacity>
+void FanInChannel<T, capacity>::restore(T &&element) {
+  used.fetch_add(1, std::memory_order_relaxed);
+  T *slot = claim(nullptr);
+  *slot = std::move(element);
+  publish(slot);
+}
+
+template <typename T, int capacity>
+bool FanInChannel<T, capacity>::Producer::acquireCredit() {
+  if (freeCapacity() == 0)
+    return false;
+  used.fetch_add(1, std::memory_order_relaxed);
+  channel->used.fetch_add(1, std::memory_order_relaxed);
+  return true;
+}
+
+template <typename T, int capacity>
+void FanInChannel<T, capacity>::Producer::releaseCredit() {
+  used.fetch_sub(1, std::memory_order_release);
+  channel->used.fetch_sub(1, std::memory_order_release);
+}
+
+template <typename T, int capacity>
+size_t FanInChannel<T, capacity>::Producer::freeCapacity() const {
+  auto inUse = used.load(std::memory_order_acquire);
+  auto channelInUse = channel->used.load(std::memory_order_acquire);
+  if (inUse >= quota || channelInUse >= capacity)
+    return 0;
+  return std::min(quota - inUse, capacity - channelInUse);
+}
+
+template <typename T, int capacity>
+T *FanInChannel<T, capacity>::Producer::reserve() {
+  if (!acquireCredit())
+    throw std::runtime_error("Channel is full");
+  return channel->claim(this);
+}
+
+template <typename T, int capacity>
+void FanInChannel<T, capacity>::Producer::commit(T *element) {
+  channel->publish(element);
+}
+
+template <typename T, int capacity>
+void FanInChannel<T, capacity>::Producer::push(T &&element) {
+  T *slot = channel->claim(this);
+  *slot = std::move(element);
+  channel->publish(slot);
+}
+
+template <typename T, int capacity>
+template <class InputIt>
+InputIt FanInChannel<T, capacity>::Producer::putNext(InputIt source,
+                                                     size_t count) {
+  if (freeCapacity() < count)
+    throw std::runtime_error("Channel is full");
+  used.fetch_add(count, std::memory_order_relaxed);
+  channel->used.fetch_add(count, std::memory_order_relaxed);
+
+  for (size_t i = 0; i < count; i++, ++source) {
+    T *slot = channel->claim(this);
+    *slot = *source;
+    channel->publish(slot);
+  }
+  return source;
+}
+
+template <typename T, int capacity>
+size_t FanInChannel<T, capacity>::awaitFirst() const {
+  auto first = head.load(std::memory_order_relaxed);
+  if (committed.load(std::memory_order_acquire) == first)
+    throw std::runtime_error("Channel is empty");
+
+  while (sequence[first & MASK].load(std::memory_order_acquire) != first + 1)
+    std::this_thread::yield();
+  return first;
+}
+
+template <typename T, int capacity> T FanInChannel<T, capacity>::getNext() {
+  Producer *owner;
+  return getNext(&owner);
+}
+
+template <typename T, int capacity>
+T FanInChannel<T, capacity>::getNext(Producer **owner) {
+  T element = std::move(*front());
+  popFront(owner);
+  return element;
+}
+
+template <typename T, int capacity> T *FanInChannel<T, capacity>::front() {
+  return &buffer[awaitFirst() & MASK];
+}
+
+template <typename T, int capacity>
+void FanInChannel<T, capacity>::popFront(Producer **producer) {
+  auto first = awaitFirst();
+  auto owner = owners[first & MASK];
+  *producer = owner;
+  sequence[first & MASK].store(first + SLOTS, std::memory_order_release);
+  head.store(first + 1, std::memory_order_release);
+  if (owner)
+    owner->used.fetch_sub(1, std::memory_order_release);
+  used.fetch_sub(1, std::memory_order_release);
+}
+
+template <typename T, int capacity>
+template <class OutputIt>
+OutputIt FanInChannel<T, capacity>::getNext(OutputIt destination,
+                                            size_t count) {
+  if (available() < count)
+    throw std::runtime_error("Channel is empty");
+
+  for (size_t i = 0; i < count; i++, ++destination)
+    *destination = getNext();
+  return destination;
+}
+
+template <typename T, int capacity> T FanInChannel<T, capacity>::peek() const {
+  return buffer[awaitFirst() & MASK];
+}
+
+template <typename T, int capacity>
+size_t FanInChannel<T, capacity>::available() const {
+  auto first = head.load(std::memory_order_acquire);
+  return committed.load(std::memory_order_acquire) - first;
+}
@@ -0,0 +1,448 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * An in port that merges the tokens of many out ports.
+ */
+
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "AbstractInPort.hpp"
+#include "AbstractOutPort.hpp"
+#include "FanInChannel.hpp"
+#include "ProgressEngine.hpp"
+#include "ReadView.hpp"
+#include "utils/mpi_helper.hpp"
+
+#pragma once
+
+class Actor;
+class AbstractOutPort;
+
+// An InPort that merges any number of local and remote sources into one
+// channel. All remote sources send with the tag of this port, so a fixed set
+// of wildcard-source receives serves all of them. Tokens of one source keep
+// their order, tokens of different sources are interleaved.
+template <typename T, int capacity>
+class FanInPort : public AbstractInPort, public RequestHandler {
+
+  friend class Actor;
+  friend class ReadView<T, FanInPort>;
+
+public:
+  template <class str>
+  explicit FanInPort(str &&name)
+      : AbstractInPort(std::forward<str>(name)), numRemoteSources(0),
+        remoteProducer(nullptr), progressEngine(nullptr),
+        messageTag(mpi::DEFAULT_TAG_ID), firstPosted(0), numPosted(0),
+        isCancelling(false), isViewHeld(false) {
+    posted.fill(false);
+    completed.fill(false);
+  }
+
+  FanInPort(FanInPort const &) = delete;
+  FanInPort(FanInPort &&) = delete;
+  FanInPort &operator=(FanInPort const &) = delete;
+  FanInPort &operator=(FanInPort &&) = delete;
+
+  T read();
+
+  // The first token, left in its slot until the view is released.
+  ReadView<T, FanInPort> read_view();
+
+  template <class OutputIt> OutputIt read_n(OutputIt destination, size_t count);
+
+  T peek() const;
+
+  size_t available() const final;
+
+  std::string toString() const final;
+
+  bool acceptsManySources() const final { return true; }
+
+  void receiveMessagesFrom(PortIdentification<AbstractOutPort> source,
+                           ProgressEngine *engine) final;
+
+  void grantCredits() final;
+
+  void disconnect(const PortIdentification<AbstractOutPort> &source) final;
+
+  void saveTokens(archive::OutArchive &out) final;
+
+  void restoreTokens(archive::InArchive &in) final;
+
+  void *getChannel() const final;
+
+  void onRequestCompleted(size_t slot) final;
+
+  void onReceiveCompleted(size_t slot, mpi::rank source) final;
+
+private:
+  void postReceives();
+
+  void cancelReceives();
+
+  void checkReadable() const;
+
+  // Takes the next token and returns the credit of a remote one.
+  T takeNext();
+
+  void returnCredit(typename FanInChannel<T, capacity>::Producer *owner);
+
+  // Grants rank what it lacks of its share, if that is at least minimum.
+  void topUpCredits(mpi::rank rank, size_t minimum);
+
+  void releaseView();
+
+  void afterRead();
+
+  FanInChannel<T, capacity> myChannel;
+  std::vector<PortIdentification<AbstractOutPort>> sources;
+  size_t numRemoteSources;
+
+  // Remote tokens are received into staging buffers, each backed by a
+  // credit of the channel, and are pushed in the order the receives were
+  // posted, which is the order MPI matches them in. All remote sources
+  // share one producer of the channel, weighted by their number.
+  typename FanInChannel<T, capacity>::Producer *remoteProducer;
+  ProgressEngine *progressEngine;
+  mpi::tag messageTag;
+  std::mutex requestMutex;
+  std::array<T, capacity> receiveBuffers;
+  std::array<bool, capacity> posted;
+  std::array<bool, capacity> completed;
+  std::array<size_t, capacity> postOrder;
+  size_t firstPosted;
+  size_t numPosted;
+  bool isCancelling;
+  // Tokens of a fixed size are received through a persistent request per
+  // staging buffer, which serves all remote sources.
+  std::array<ProgressEngine::PersistentRequest, capacity> persistentReceives;
+
+  // Credits are granted per rank, as sources on one rank share them. The
+  // ranks of the remote tokens in the channel are kept in channel order.
+  // A rank holds its credits until its tokens are read, and gets them back
+  // only up to its share of the remote quota. Credits beyond a share that
+  // shrank are not granted again.
+  std::array<mpi::rank, capacity> receivedFrom;
+  std::deque<mpi::rank> remoteOrigins;
+  std::map<mpi::rank, size_t> creditShares;
+  std::map<mpi::rank, size_t> grantedCredits;
+
+  bool isViewHeld;
+};
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::receiveMessagesFrom(
+    PortIdentification<AbstractOutPort> source, ProgressEngine *engine) {
+  if (source.isExternal() && source.getTransport() == Transport::RMA)
+    throw std::runtime_error("FanInPort " + getName() +
+                             " is shared by its sources and cannot receive "
+                             "through RMA.");
+  progressEngine = engine;
+  sources.push_back(source);
+  if (source.isExternal()) {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    messageTag = source.getTag();
+    numRemoteSources++;
+    if (remoteProducer)
+      myChannel.setWeight(remoteProducer, numRemoteSources);
+    else
+      remoteProducer = myChannel.attach();
+    postReceives();
+  } else if (numRemoteSources > 0) {
+    // The source attached with its own quota. Give back the credits the
+    // receives hold beyond what is left for them.
+    cancelReceives();
+    std::lock_guard<std::mutex> lock(requestMutex);
+    postReceives();
+  }
+}
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::grantCredits() {
+  std::lock_guard<std::mutex> lock(requestMutex);
+  if (numRemoteSources == 0)
+    return;
+
+  // The remote quota is known only once all sources are connected.
+  creditShares.clear();
+  for (auto &source : sources) {
+    if (source.isExternal())
+      creditShares[source.getRank()] += remoteProducer->getQuota();
+  }
+  for (auto &share : creditShares) {
+    // Without a credit, a rank could never send.
+    share.second = std::max<size_t>(share.second / numRemoteSources, 1);
+    topUpCredits(share.first, 1);
+  }
+}
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::topUpCredits(mpi::rank rank, size_t minimum) {
+  auto share = creditShares[rank];
+  auto &granted = grantedCredits[rank];
+  if (granted >= share || share - granted < minimum)
+    return;
+  progressEngine->grantCredits(rank, messageTag, share - granted);
+  granted = share;
+}
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::disconnect(
+    const PortIdentification<AbstractOutPort> &source) {
+  auto sourceIt = std::find(sources.begin(), sources.end(), source);
+  if (sourceIt == sources.end())
+    return;
+  sources.erase(sourceIt);
+
+  if (!source.isExternal())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    // The remaining remote sources are served by the same receives.
+    if (--numRemoteSources > 0) {
+      myChannel.setWeight(remoteProducer, numRemoteSources);
+      // The last source of a rank takes the rank's account with it.
+      if (std::none_of(sources.begin(), sources.end(), [&](auto &other) {
+            return other.isExternal() && other.getRank() == source.getRank();
+          })) {
+        creditShares.erase(source.getRank());
+        grantedCredits.erase(source.getRank());
+      }
+      return;
+    }
+  }
+  cancelReceives();
+  for (auto &request : persistentReceives)
+    progressEngine->release(request);
+  myChannel.detach(remoteProducer);
+  remoteProducer = nullptr;
+  remoteOrigins.clear();
+  creditShares.clear();
+  grantedCredits.clear();
+}
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::cancelReceives() {
+  {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    isCancelling = true;
+  }
+  // As in InPort, once the oldest receive was cancelled, so were all later
+  // ones. Receives that matched before are delivered by the engine.
+  progressEngine->cancel(this);
+  std::lock_guard<std::mutex> lock(requestMutex);
+  for (; numPosted > 0; numPosted--)
+    remoteProducer->releaseCredit();
+  posted.fill(false);
+  completed.fill(false);
+  isCancelling = false;
+}
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::onReceiveCompleted(size_t slot,
+                                                mpi::rank source) {
+  receivedFrom[slot] = source;
+  onRequestCompleted(slot);
+}
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::onRequestCompleted(size_t slot) {
+  bool hasDelivered = false;
+  {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    completed[slot] = true;
+    while (numPosted > 0 && completed[postOrder[firstPosted]]) {
+      auto first = postOrder[firstPosted];
+      remoteProducer->push(std::move(receiveBuffers[first]));
+      remoteOrigins.push_back(receivedFrom[first]);
+      posted[first] = false;
+      completed[first] = false;
+      firstPosted = (firstPosted + 1) % capacity;
+      numPosted--;
+      hasDelivered = true;
+    }
+    postReceives();
+  }
+  if (hasDelivered)
+    notifyOwner();
+}
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::postReceives() {
+  if (numRemoteSources == 0 || isCancelling)
+    return;
+
+  for (size_t slot = 0; slot < capacity; slot++) {
+    if (posted[slot])
+      continue;
+    if (!remoteProducer->acquireCredit())
+      return;
+    posted[slot] = true;
+    postOrder[(firstPosted + numPosted) % capacity] = slot;
+    numPosted++;
+    auto transfer =
+        mpi::makeReceive(MPI_ANY_SOURCE, messageTag, &receiveBuffers[slot]);
+    if (mpi::is_dynamically_sized<T>::value)
+      progressEngine->submit(transfer, this, slot);
+    else
+      progressEngine->submitPersistent(transfer, persistentReceives[slot],
+                                       this, slot);
+  }
+}
+
+template <typename T, int capacity> void FanInPort<T, capacity>::afterRead() {
+  if (numRemoteSources > 0) {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    postReceives();
+  }
+  for (auto &source : sources) {
+    if (source.isLocal())
+      source.getPort()->notifyOwner();
+  }
+}
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::checkReadable() const {
+  if (sources.empty())
+    throw std::runtime_error(
+        std::string("Unable to read from channel, channel not connected."));
+  if (isViewHeld)
+    throw std::runtime_error("FanInPort " + getName() +
+                             " is still held by a read view.");
+}
+
+template <typename T, int capacity> T FanInPort<T, capacity>::read() {
+  checkReadable();
+  T element = takeNext();
+  afterRead();
+  return element;
+}
+
+template <typename T, int capacity>
+ReadView<T, FanInPort<T, capacity>> FanInPort<T, capacity>::read_view() {
+  checkReadable();
+  ReadView<T, FanInPort> view(myChannel.front(), this);
+  isViewHeld = true;
+  return view;
+}
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::releaseView() {
+  isViewHeld = false;
+  typename FanInChannel<T, capacity>::Producer *owner;
+  mpi::recycle(*myChannel.front());
+  myChannel.popFront(&owner);
+  returnCredit(owner);
+  afterRead();
+}
+
+template <typename T, int capacity> T FanInPort<T, capacity>::takeNext() {
+  typename FanInChannel<T, capacity>::Producer *owner;
+  T element = myChannel.getNext(&owner);
+  returnCredit(owner);
+  return element;
+}
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::returnCredit(
+    typename FanInChannel<T, capacity>::Producer *owner) {
+  if (!owner || owner != remoteProducer)
+    return;
+
+  std::lock_guard<std::mutex> lock(requestMutex);
+  if (remoteOrigins.empty())
+    return;
+  auto origin = remoteOrigins.front();
+  remoteOrigins.pop_front();
+  auto share = creditShares.find(origin);
+  // The rank may have disconnected since it sent the token.
+  if (share == creditShares.end())
+    return;
+  // Tokens of an overdrawn shared account were sent without a credit.
+  auto &granted = grantedCredits[origin];
+  if (granted > 0)
+    granted--;
+  // Credits are returned in batches of a quarter of the share.
+  topUpCredits(origin, (share->second + 3) / 4);
+}
+
+template <typename T, int capacity>
+template <class OutputIt>
+OutputIt FanInPort<T, capacity>::read_n(OutputIt destination, size_t count) {
+  checkReadable();
+  if (myChannel.available() < count)
+    throw std::runtime_error("Channel is empty");
+
+  for (size_t i = 0; i < count; i++, ++destination)
+    *destination = takeNext();
+  afterRead();
+  return destination;
+}
+
+template <typename T, int capacity> T FanInPort<T, capacity>::peek() const {
+  return myChannel.peek();
+}
+
+template <typename T, int capacity>
+size_t FanInPort<T, capacity>::available() const {
+  return myChannel.available();
+}
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::saveTokens(archive::OutArchive &out) {
+  size_t numTokens = myChannel.available();
+  out << numTokens;
+  for (size_t i = 0; i < numTokens; i++)
+    archive::save(out, takeNext());
+}
+
+template <typename T, int capacity>
+void FanInPort<T, capacity>::restoreTokens(archive::InArchive &in) {
+  size_t numTokens;
+  in >> numTokens;
+  for (size_t i = 0; i < numTokens; i++) {
+    T element;
+    archive::load(in, element);
+    myChannel.restore(std::move(element));
+  }
+}
+
+template <typename T, int capacity>
+void *FanInPort<T, capacity>::getChannel() const {
+  return (void *)(&this->myChannel);
+}
+
+template <typename T, int capacity>
+std::string FanInPort<T, capacity>::toString() const {
+  std::stringstream ss;
+  ss << "[FIP-" << capacity << " ID: " << myIdentification.getName() << "]";
+  return ss.str();
+}
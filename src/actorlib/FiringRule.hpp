@@ -0,0 +1,74 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Declarative firing conditions of an actor. A rule holds when every listed
+ * InPort has at least the requested number of tokens, every listed OutPort
+ * has at least the requested number of free slots, and all guards hold.
+ */
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "AbstractInPort.hpp"
+#include "AbstractOutPort.hpp"
+
+#pragma once
+
+class FiringRule {
+public:
+  FiringRule &consume(AbstractInPort *port, size_t tokens = 1) {
+    inputs.emplace_back(port, tokens);
+    return *this;
+  }
+
+  FiringRule &produce(AbstractOutPort *port, size_t slots = 1) {
+    outputs.emplace_back(port, slots);
+    return *this;
+  }
+
+  // Guards may only depend on ports or on state the actor changes inside
+  // act(), since they are re-evaluated on channel events and after act().
+  FiringRule &guard(std::function<bool()> predicate) {
+    guards.push_back(std::move(predicate));
+    return *this;
+  }
+
+  bool isSatisfied() const {
+    for (auto &input : inputs)
+      if (input.first->available() < input.second)
+        return false;
+    for (auto &output : outputs)
+      if (output.first->freeCapacity() < output.second)
+        return false;
+    for (auto &predicate : guards)
+      if (!predicate())
+        return false;
+    return true;
+  }
+
+private:
+  std::vector<std::pair<AbstractInPort *, size_t>> inputs;
+  std::vector<std::pair<AbstractOutPort *, size_t>> outputs;
+  std::vector<std::function<bool()>> guards;
+};
@@ -26,6 +26,7 @@
  *
  */
 
+#include <array>
 #include <memory>
 #include <mutex>
 #include <sstream>
@@ -34,6 +35,9 @@
 #include "AbstractInPort.hpp"
 #include "AbstractOutPort.hpp"
 #include "Channel.hpp"
+#include "ProgressEngine.hpp"
+#include "ReadView.hpp"
+#include "utils/codec.hpp"
 #include "utils/mpi_helper.hpp"
 
 #pragma once
@@ -41,94 +45,339 @@
 class Actor;
 class AbstractOutPort;
 
-template <typename T, int capacity> class InPort : public AbstractInPort {
+// Tokens from a remote source that does not share memory with this rank
+// are decoded by Codec, which has to be the codec of the source.
+template <typename T, int capacity, class Codec = codec::None>
+class InPort : public AbstractInPort, public RequestHandler {
 
   friend class Actor;
+  friend class ReadView<T, InPort>;
 
 public:
   template <class str>
-  explicit InPort<T, capacity>(str &&name)
+  explicit InPort(str &&name)
       : AbstractInPort(std::forward<str>(name)),
-        otherPortIdentification(nullptr) {}
+        otherPortIdentification(nullptr), progressEngine(nullptr),
+        firstPosted(0), numPosted(0), messageSize(0), pendingCredits(0),
+        isViewHeld(false) {
+    posted.fill(false);
+    completed.fill(false);
+  }
 
-  InPort<T, capacity>(InPort<T, capacity> const &) = delete;
-  InPort<T, capacity>(InPort<T, capacity> &&) = delete;
-  InPort<T, capacity> &operator=(InPort<T, capacity> const &) = delete;
-  InPort<T, capacity> &operator=(InPort<T, capacity> &&) = delete;
+  InPort(InPort const &) = delete;
+  InPort(InPort &&) = delete;
+  InPort &operator=(InPort const &) = delete;
+  InPort &operator=(InPort &&) = delete;
 
+  // Moves the first token out of its slot.
   T read();
 
+  // The first token, left in its slot until the view is released.
+  ReadView<T, InPort> read_view();
+
+  // Reads count tokens into destination. Sources are notified once for
+  // the whole batch.
+  template <class OutputIt> OutputIt read_n(OutputIt destination, size_t count);
+
   T peek() const;
 
-  size_t available() const;
+  // Receives the vector tokens of a remote OutPort that declared the same
+  // messageSize with usePersistentRequests(). Each channel slot then has a
+  // persistent request and keeps its memory between tokens. Has to be
+  // called before the port is connected.
+  void usePersistentRequests(size_t messageSize) {
+    if (otherPortIdentification.isConnected())
+      throw std::runtime_error("InPort " + getName() +
+                               " is connected already.");
+    this->messageSize = messageSize;
+  }
+
+  size_t available() const final;
 
   std::string toString() const final;
 
-  void receiveMessagesFrom(
-      PortIdentification<AbstractOutPort> portIdentification) final {
+  void
+  receiveMessagesFrom(PortIdentification<AbstractOutPort> portIdentification,
+                      ProgressEngine *engine) final {
+    if (otherPortIdentification.isConnected())
+      throw std::runtime_error("InPort " + getName() +
+                               " is already connected, use a FanInPort to "
+                               "receive from several sources.");
     otherPortIdentification = portIdentification;
+    progressEngine = engine;
+    if (otherPortIdentification.isExternal()) {
+      if (receivesPuts()) {
+        if (mpi::is_dynamically_sized<T>::value)
+          throw std::runtime_error("InPort " + getName() +
+                                   " cannot receive tokens of varying size "
+                                   "through RMA.");
+        progressEngine->exposeRing(
+            otherPortIdentification.getRank(),
+            otherPortIdentification.getTag(), myChannel.data(),
+            sizeof(T) * myChannel.slots(), myChannel.nextIndex(),
+            myChannel.slots(), this);
+      }
+      openRequests();
+      progressEngine->grantCredits(otherPortIdentification.getRank(),
+                                   otherPortIdentification.getTag(),
+                                   capacity - myChannel.available());
+    }
   }
 
+  void disconnect(const PortIdentification<AbstractOutPort> &source) final;
+
+  void saveTokens(archive::OutArchive &out) final;
+
+  void restoreTokens(archive::InArchive &in) final;
+
   void *getChannel() const final;
 
+  void onRequestCompleted(size_t slot) final;
+
 private:
-  void recycleRequests();
+  // Credits are returned in batches of a quarter of the capacity, which
+  // keeps the sender busy while the grant is on its way.
+  static constexpr size_t CREDIT_BATCH = (capacity + 3) / 4;
+
   void openRequests();
 
+  // Whether the remote source puts its tokens into the channel.
+  bool receivesPuts() const {
+    return otherPortIdentification.isExternal() &&
+           otherPortIdentification.getTransport() == Transport::RMA;
+  }
+
+  bool decodesTokens() const {
+    return codec::is_enabled<Codec>::value &&
+           otherPortIdentification.isExternal() && !receivesPuts() &&
+           !progressEngine->sharesMemoryWith(otherPortIdentification.getRank());
+  }
+
+  void checkReadable() const;
+
+  void releaseView();
+
+  // Called after count tokens were read.
+  void afterRead(size_t count);
+
   Channel<T, capacity> myChannel;
   PortIdentification<AbstractOutPort> otherPortIdentification;
-  std::array<mpi::ReceiveRequest<T>, capacity> requests;
+
+  // Receives may complete in any order, but their buffers are handed to
+  // the channel in the order they were posted.
+  ProgressEngine *progressEngine;
+  std::mutex requestMutex;
+  std::array<T *, capacity> receiveBuffers;
+  std::array<bool, capacity> posted;
+  std::array<bool, capacity> completed;
+  std::array<size_t, capacity> postOrder;
+  // Encoded tokens, by slot, until they are decoded into their buffers.
+  std::array<std::vector<char>, capacity> encodedBuffers;
+  size_t firstPosted;
+  size_t numPosted;
+  // Tokens of a fixed size are received through a persistent request per
+  // channel slot, as are vector tokens once usePersistentRequests() gave
+  // their size.
+  std::array<ProgressEngine::PersistentRequest, Channel<T, capacity>::slots()>
+      persistentReceives;
+  size_t messageSize;
+
+  // Consumed tokens of a remote source whose credits were not returned.
+  size_t pendingCredits;
+
+  bool isViewHeld;
 };
 
-template <typename T, int capacity>
-size_t InPort<T, capacity>::available() const {
+template <typename T, int capacity, class Codec>
+size_t InPort<T, capacity, Codec>::available() const {
   return myChannel.available();
 }
 
-template <typename T, int capacity> T InPort<T, capacity>::peek() const {
+template <typename T, int capacity, class Codec>
+T InPort<T, capacity, Codec>::peek() const {
   return myChannel.peek();
 }
 
-template <typename T, int capacity>
-void InPort<T, capacity>::recycleRequests() {
-  for (auto &request : requests) {
-    if (request.isDirty()) {
-      if (request.hasFinished()) {
-        myChannel.returnElement(request.getBuffer());
-        request = mpi::ReceiveRequest<T>();
-      }
+template <typename T, int capacity, class Codec>
+void InPort<T, capacity, Codec>::onRequestCompleted(size_t slot) {
+  if (decodesTokens()) {
+    codec::decode<Codec>(encodedBuffers[slot], *receiveBuffers[slot]);
+    mpi::recycle(encodedBuffers[slot]);
+  }
+  bool hasDelivered = false;
+  {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    // Puts arrive in order, each fills the oldest reserved slot.
+    if (receivesPuts())
+      slot = postOrder[firstPosted];
+    completed[slot] = true;
+    while (numPosted > 0 && completed[postOrder[firstPosted]]) {
+      auto first = postOrder[firstPosted];
+      myChannel.commit(receiveBuffers[first]);
+      posted[first] = false;
+      completed[first] = false;
+      firstPosted = (firstPosted + 1) % capacity;
+      numPosted--;
+      hasDelivered = true;
+    }
+  }
+  if (hasDelivered)
+    notifyOwner();
+}
+
+template <typename T, int capacity, class Codec>
+void InPort<T, capacity, Codec>::openRequests() {
+  std::lock_guard<std::mutex> lock(requestMutex);
+  for (size_t slot = 0; slot < capacity; slot++) {
+    if (posted[slot] || myChannel.freeCapacity() == 0)
+      continue;
+    receiveBuffers[slot] = myChannel.reserve();
+    posted[slot] = true;
+    postOrder[(firstPosted + numPosted) % capacity] = slot;
+    numPosted++;
+    if (receivesPuts())
+      continue;
+    if (decodesTokens()) {
+      progressEngine->submit(
+          mpi::makeReceive(otherPortIdentification.getRank(),
+                           otherPortIdentification.getTag(),
+                           &encodedBuffers[slot]),
+          this, slot);
+      continue;
     }
+    auto transfer =
+        messageSize > 0
+            ? mpi::makeBoundedReceive(otherPortIdentification.getRank(),
+                                      otherPortIdentification.getTag(),
+                                      receiveBuffers[slot], messageSize)
+            : mpi::makeReceive(otherPortIdentification.getRank(),
+                               otherPortIdentification.getTag(),
+                               receiveBuffers[slot]);
+    if (mpi::is_dynamically_sized<T>::value && messageSize == 0)
+      progressEngine->submit(transfer, this, slot);
+    else
+      progressEngine->submitPersistent(
+          transfer,
+          persistentReceives[myChannel.indexOf(receiveBuffers[slot])], this,
+          slot);
   }
 }
 
-template <typename T, int capacity> void InPort<T, capacity>::openRequests() {
-  for (auto &request : requests) {
-    if (!request.isDirty())
-      request = mpi::Irecv<T>(otherPortIdentification.getRank(),
-                              myIdentification.getTag(), myChannel.reserve());
+template <typename T, int capacity, class Codec>
+void InPort<T, capacity, Codec>::disconnect(
+    const PortIdentification<AbstractOutPort> &) {
+  if (otherPortIdentification.isExternal()) {
+    // Receives that matched before they could be cancelled are delivered
+    // by the engine. Messages do not overtake each other, so once the
+    // oldest remaining receive was cancelled, so were all later ones.
+    if (receivesPuts())
+      progressEngine->withdrawRing(this);
+    progressEngine->cancel(this);
+    std::lock_guard<std::mutex> lock(requestMutex);
+    myChannel.cancelReservations();
+    posted.fill(false);
+    completed.fill(false);
+    numPosted = 0;
+    pendingCredits = 0;
+    for (auto &request : persistentReceives)
+      progressEngine->release(request);
+  }
+  otherPortIdentification = PortIdentification<AbstractOutPort>(nullptr);
+}
+
+template <typename T, int capacity, class Codec>
+void InPort<T, capacity, Codec>::saveTokens(archive::OutArchive &out) {
+  size_t numTokens = myChannel.available();
+  out << numTokens;
+  for (size_t i = 0; i < numTokens; i++)
+    archive::save(out, myChannel.getNext());
+}
+
+template <typename T, int capacity, class Codec>
+void InPort<T, capacity, Codec>::restoreTokens(archive::InArchive &in) {
+  size_t numTokens;
+  in >> numTokens;
+  for (size_t i = 0; i < numTokens; i++) {
+    T *element = myChannel.reserve();
+    archive::load(in, *element);
+    myChannel.commit(element);
   }
 }
 
-template <typename T, int capacity> T InPort<T, capacity>::read() {
+template <typename T, int capacity, class Codec>
+void InPort<T, capacity, Codec>::checkReadable() const {
   if (!otherPortIdentification.isConnected())
     throw std::runtime_error(
         std::string("Unable to read from channel, channel not connected."));
+  if (isViewHeld)
+    throw std::runtime_error("InPort " + getName() +
+                             " is still held by a read view.");
+}
 
-  if (otherPortIdentification.isExternal()) {
-    recycleRequests();
-    openRequests();
+template <typename T, int capacity, class Codec>
+T InPort<T, capacity, Codec>::read() {
+  checkReadable();
+  T element = myChannel.getNext();
+  afterRead(1);
+  return element;
+}
+
+template <typename T, int capacity, class Codec>
+ReadView<T, InPort<T, capacity, Codec>>
+InPort<T, capacity, Codec>::read_view() {
+  checkReadable();
+  ReadView<T, InPort> view(myChannel.front(), this);
+  isViewHeld = true;
+  return view;
+}
+
+template <typename T, int capacity, class Codec>
+void InPort<T, capacity, Codec>::releaseView() {
+  isViewHeld = false;
+  // A local source writes its next token into the slot itself, and a
+  // persistent receive of a declared size reuses the slot's memory.
+  if (otherPortIdentification.isLocal() || messageSize > 0)
+    mpi::vacate(*myChannel.front());
+  else
+    mpi::recycle(*myChannel.front());
+  myChannel.popFront();
+  afterRead(1);
+}
+
+template <typename T, int capacity, class Codec>
+template <class OutputIt>
+OutputIt InPort<T, capacity, Codec>::read_n(OutputIt destination,
+                                            size_t count) {
+  checkReadable();
+  destination = myChannel.getNext(destination, count);
+  afterRead(count);
+  return destination;
+}
+
+template <typename T, int capacity, class Codec>
+void InPort<T, capacity, Codec>::afterRead(size_t count) {
+  if (otherPortIdentification.isLocal()) {
+    otherPortIdentification.getPort()->notifyOwner();
+    return;
   }
 
-  return myChannel.getNext();
+  openRequests();
+  pendingCredits += count;
+  if (pendingCredits >= CREDIT_BATCH) {
+    progressEngine->grantCredits(otherPortIdentification.getRank(),
+                                 otherPortIdentification.getTag(),
+                                 pendingCredits);
+    pendingCredits = 0;
+  }
 }
 
-template <typename T, int capacity>
-void *InPort<T, capacity>::getChannel() const {
+template <typename T, int capacity, class Codec>
+void *InPort<T, capacity, Codec>::getChannel() const {
   return (void *)(&this->myChannel);
 }
 
-template <typename T, int capacity>
-std::string InPort<T, capacity>::toString() const {
+template <typename T, int capacity, class Codec>
+std::string InPort<T, capacity, Codec>::toString() const {
   std::stringstream ss;
   ss << "[IP-" << capacity << " ID: " << myIdentification.getName() << "]";
   return ss.str();
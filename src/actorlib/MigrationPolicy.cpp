@@ -0,0 +1,75 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include <algorithm>
+#include <numeric>
+
+#include "MigrationPolicy.hpp"
+
+#include "Actor.hpp"
+
+using namespace std;
+
+BusyTimeMigrationPolicy::BusyTimeMigrationPolicy(double tolerance)
+    : tolerance(tolerance) {}
+
+vector<Migration>
+BusyTimeMigrationPolicy::selectMigrations(const vector<double> &busyTimePerRank,
+                                          const vector<Actor *> &localActors) {
+  auto numRanks = busyTimePerRank.size();
+  auto mean = accumulate(busyTimePerRank.begin(), busyTimePerRank.end(), 0.0) /
+              numRanks;
+  mpi::rank me = mpi::me();
+  if (mean <= 0.0 || busyTimePerRank[me] <= mean * (1.0 + tolerance))
+    return {};
+
+  // Every rank sorts the same way, so the pairing is consistent.
+  vector<mpi::rank> ranks(numRanks);
+  iota(ranks.begin(), ranks.end(), 0);
+  stable_sort(ranks.begin(), ranks.end(), [&](mpi::rank a, mpi::rank b) {
+    return busyTimePerRank[a] > busyTimePerRank[b];
+  });
+  size_t position = find(ranks.begin(), ranks.end(), me) - ranks.begin();
+  if (position >= numRanks / 2)
+    return {};
+
+  auto partner = ranks[numRanks - 1 - position];
+  auto remaining = min(busyTimePerRank[me] - mean,
+                       mean - busyTimePerRank[partner]);
+
+  auto candidates = localActors;
+  sort(candidates.begin(), candidates.end(), [](Actor *a, Actor *b) {
+    return a->getBusyTime() > b->getBusyTime();
+  });
+
+  vector<Migration> migrations;
+  for (auto actor : candidates) {
+    auto busyTime = actor->getBusyTime();
+    if (busyTime > 0.0 && busyTime <= remaining) {
+      migrations.push_back({actor->getName(), partner});
+      remaining -= busyTime;
+    }
+  }
+  return migrations;
+}
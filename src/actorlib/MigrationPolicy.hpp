@@ -0,0 +1,69 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Policies deciding which actors migrate to which rank, based on the time
+ * the actors of each rank spent in act() since the last rebalancing.
+ */
+
+#include <string>
+#include <vector>
+
+#include "utils/mpi_helper.hpp"
+
+#pragma once
+
+class Actor;
+
+struct Migration {
+  std::string actorName;
+  mpi::rank targetRank;
+};
+
+// Consulted by ActorGraph::run after global termination. Actors therefore
+// only move between runs, never while a run is in progress; applications
+// that want to rebalance periodically split their work into several runs.
+class MigrationPolicy {
+public:
+  virtual ~MigrationPolicy() = default;
+
+  // Called on every rank with the busy time of all ranks, indexed by rank.
+  // Returns the migrations of local actors only.
+  virtual std::vector<Migration>
+  selectMigrations(const std::vector<double> &busyTimePerRank,
+                   const std::vector<Actor *> &localActors) = 0;
+};
+
+// Pairs the most loaded rank with the least loaded one, the second most
+// loaded with the second least loaded and so on. A rank exceeding the mean
+// busy time by more than the tolerance moves its busiest actors that fit
+// into the difference to its partner.
+class BusyTimeMigrationPolicy : public MigrationPolicy {
+public:
+  explicit BusyTimeMigrationPolicy(double tolerance = 0.1);
+
+  std::vector<Migration>
+  selectMigrations(const std::vector<double> &busyTimePerRank,
+                   const std::vector<Actor *> &localActors) final;
+
+private:
+  double tolerance;
+};
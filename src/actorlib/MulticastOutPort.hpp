@@ -0,0 +1,284 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * An out port that sends every token to all of its destinations.
+ */
+
+#include "AbstractInPort.hpp"
+#include "AbstractOutPort.hpp"
+#include "Channel.hpp"
+#include "CreditAccount.hpp"
+#include "FanInChannel.hpp"
+#include "ProgressEngine.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#pragma once
+
+class Actor;
+class AbstractInPort;
+
+// Sends every token to all connected InPorts as one immutable payload,
+// std::shared_ptr<const T>, which is the element type of the destinations.
+// Local destinations share the payload, remote ones are sent from it
+// directly, so a token is never copied, only its reference count changes.
+// Every remote destination gets a message of its own from this rank, also
+// for large fan-outs; tokens are not forwarded along a tree. While the
+// graph exchanges with neighbours, these messages travel in its rounds.
+template <typename T, int capacity>
+class MulticastOutPort : public AbstractOutPort, public RequestHandler {
+
+  friend class Actor;
+
+public:
+  using Payload = std::shared_ptr<const T>;
+
+private:
+  struct Destination {
+    PortIdentification<AbstractInPort> port;
+    // Set if the destination is a local FanInPort.
+    typename FanInChannel<Payload, capacity>::Producer *producer;
+    // Set if the destination is remote.
+    CreditAccount *credits;
+  };
+
+  std::vector<Destination> destinations;
+  size_t numRemoteDestinations;
+  ProgressEngine *progressEngine;
+
+  // A payload stays here until it has been sent to all remote destinations.
+  std::array<Payload, capacity> sendPayloads;
+  std::array<std::atomic<size_t>, capacity> pendingSends;
+  std::array<std::atomic<bool>, capacity> inFlight;
+
+public:
+  template <class str>
+  explicit MulticastOutPort(str &&name)
+      : AbstractOutPort(std::forward<str>(name)), numRemoteDestinations(0),
+        progressEngine(nullptr) {
+    for (auto &pending : pendingSends)
+      pending.store(0);
+    for (auto &isInFlight : inFlight)
+      isInFlight.store(false);
+  }
+
+  MulticastOutPort(MulticastOutPort const &) = delete;
+  MulticastOutPort(MulticastOutPort &&) = delete;
+  MulticastOutPort &operator=(MulticastOutPort const &) = delete;
+  MulticastOutPort &operator=(MulticastOutPort &&) = delete;
+
+  void write(Payload payload);
+
+  void write(T element) {
+    write(std::make_shared<const T>(std::move(element)));
+  }
+
+  // Constructs the shared payload from args.
+  template <class... Args> void emplace(Args &&... args) {
+    write(std::make_shared<const T>(std::forward<Args>(args)...));
+  }
+
+  // The capacity left in the fullest destination.
+  size_t freeCapacity() const final;
+
+  std::string toString() const final;
+
+  bool acceptsManyDestinations() const final { return true; }
+
+  void sendMessagesTo(PortIdentification<AbstractInPort> portIdentification,
+                      ProgressEngine *engine) final;
+
+  void
+  disconnect(const PortIdentification<AbstractInPort> &destination) final;
+
+  void onRequestCompleted(size_t slot) final;
+
+private:
+  // Optionally leaves the credits of remote destinations out.
+  size_t capacityLeft(bool withCredits) const;
+
+  size_t acquireSendSlot();
+
+  // Calls operation with the typed channel of a local destination.
+  template <class Operation>
+  auto withLocalChannel(const Destination &destination,
+                        Operation &&operation) const;
+};
+
+template <typename T, int capacity>
+void MulticastOutPort<T, capacity>::sendMessagesTo(
+    PortIdentification<AbstractInPort> portIdentification,
+    ProgressEngine *engine) {
+  if (portIdentification.isExternal() &&
+      portIdentification.getTransport() == Transport::RMA)
+    throw std::runtime_error("MulticastOutPort " + getName() +
+                             " cannot send through RMA.");
+  progressEngine = engine;
+  Destination destination{portIdentification, nullptr, nullptr};
+  if (portIdentification.isExternal()) {
+    numRemoteDestinations++;
+    destination.credits = engine->subscribeCredits(
+        portIdentification.getRank(), portIdentification.getTag(), this);
+  } else if (portIdentification.getPort()->acceptsManySources()) {
+    destination.producer = static_cast<FanInChannel<Payload, capacity> *>(
+                               portIdentification.getPort()->getChannel())
+                               ->attach();
+  }
+  destinations.push_back(destination);
+}
+
+template <typename T, int capacity>
+void MulticastOutPort<T, capacity>::disconnect(
+    const PortIdentification<AbstractInPort> &destination) {
+  for (auto &isInFlight : inFlight) {
+    if (isInFlight.load(std::memory_order_acquire))
+      throw std::runtime_error("Cannot disconnect a port with messages in "
+                               "flight.");
+  }
+
+  auto destinationIt = std::find_if(
+      destinations.begin(), destinations.end(),
+      [&](const Destination &other) { return other.port == destination; });
+  if (destinationIt == destinations.end())
+    return;
+
+  if (destinationIt->producer)
+    static_cast<FanInChannel<Payload, capacity> *>(
+        destinationIt->port.getPort()->getChannel())
+        ->detach(destinationIt->producer);
+  if (destinationIt->credits) {
+    progressEngine->unsubscribeCredits(destinationIt->credits, this);
+    numRemoteDestinations--;
+  }
+  destinations.erase(destinationIt);
+}
+
+template <typename T, int capacity>
+void MulticastOutPort<T, capacity>::onRequestCompleted(size_t slot) {
+  if (pendingSends[slot].fetch_sub(1, std::memory_order_acq_rel) > 1)
+    return;
+  sendPayloads[slot].reset();
+  inFlight[slot].store(false, std::memory_order_release);
+  notifyOwner();
+}
+
+template <typename T, int capacity>
+size_t MulticastOutPort<T, capacity>::acquireSendSlot() {
+  for (size_t slot = 0; slot < capacity; slot++) {
+    if (!inFlight[slot].load(std::memory_order_acquire))
+      return slot;
+  }
+  throw std::runtime_error("No free send buffer.");
+}
+
+template <typename T, int capacity>
+size_t MulticastOutPort<T, capacity>::freeCapacity() const {
+  return capacityLeft(true);
+}
+
+template <typename T, int capacity>
+size_t MulticastOutPort<T, capacity>::capacityLeft(bool withCredits) const {
+  size_t free = capacity;
+  if (numRemoteDestinations > 0)
+    free = std::count_if(
+        inFlight.begin(), inFlight.end(),
+        [](const auto &isInFlight) { return !isInFlight; });
+
+  for (auto &destination : destinations) {
+    if (destination.credits) {
+      if (withCredits)
+        free = std::min(free, destination.credits->available());
+    } else
+      free = std::min(free, withLocalChannel(destination, [](auto channel) {
+                        return channel->freeCapacity();
+                      }));
+  }
+  return free;
+}
+
+template <typename T, int capacity>
+void MulticastOutPort<T, capacity>::write(Payload payload) {
+  if (destinations.empty())
+    throw std::runtime_error(
+        "Unable to write to channel, channel not connected.");
+  if (capacityLeft(false) == 0)
+    throw std::runtime_error("No free space in channel!");
+  // Credits are taken from all remote destinations or from none.
+  for (auto destination = destinations.begin();
+       destination != destinations.end(); ++destination) {
+    if (!destination->credits || destination->credits->tryConsume(1))
+      continue;
+    for (auto taken = destinations.begin(); taken != destination; ++taken) {
+      if (taken->credits)
+        taken->credits->refund(1);
+    }
+    throw std::runtime_error("No free space in channel!");
+  }
+
+  if (numRemoteDestinations > 0) {
+    auto slot = acquireSendSlot();
+    sendPayloads[slot] = payload;
+    pendingSends[slot].store(numRemoteDestinations, std::memory_order_relaxed);
+    inFlight[slot].store(true, std::memory_order_relaxed);
+    // MPI only reads from the buffer, which is shared by all sends.
+    T &buffer = const_cast<T &>(*sendPayloads[slot]);
+    for (auto &destination : destinations) {
+      if (!destination.credits)
+        continue;
+      progressEngine->submit(mpi::makeSend(destination.port.getRank(),
+                                           destination.port.getTag(), buffer),
+                             this, slot);
+    }
+  }
+
+  for (auto &destination : destinations) {
+    if (destination.port.isExternal())
+      continue;
+    withLocalChannel(destination, [&payload](auto channel) {
+      auto element = channel->reserve();
+      *element = payload;
+      channel->commit(element);
+    });
+    destination.port.getPort()->notifyOwner();
+  }
+}
+
+template <typename T, int capacity>
+template <class Operation>
+auto MulticastOutPort<T, capacity>::withLocalChannel(
+    const Destination &destination, Operation &&operation) const {
+  if (destination.producer)
+    return operation(destination.producer);
+  return operation(static_cast<Channel<Payload, capacity> *>(
+      destination.port.getPort()->getChannel()));
+}
+
+template <typename T, int capacity>
+std::string MulticastOutPort<T, capacity>::toString() const {
+  std::stringstream ss;
+  ss << "[MOP-" << capacity << " ID: " << myIdentification.getName() << "]";
+  return ss.str();
+}
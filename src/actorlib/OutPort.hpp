@@ -29,8 +29,16 @@
 #include "AbstractInPort.hpp"
 #include "AbstractOutPort.hpp"
 #include "Channel.hpp"
+#include "CreditAccount.hpp"
+#include "FanInChannel.hpp"
+#include "ProgressEngine.hpp"
+#include "utils/codec.hpp"
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <memory>
+#include <new>
+#include <type_traits>
 
 #pragma once
 
@@ -38,143 +46,414 @@ class ActorGraph;
 class Actor;
 class AbstractInPort;
 
-template <typename T, int capacity> class OutPort : public AbstractOutPort {
+// Tokens for a remote destination that does not share memory with this
+// rank are encoded by Codec, see utils/codec.hpp. The destination has to
+// decode them with the same codec.
+template <typename T, int capacity, class Codec = codec::None>
+class OutPort : public AbstractOutPort, public RequestHandler {
 
   friend class Actor;
   friend class ActorGraph;
 
 private:
   PortIdentification<AbstractInPort> otherPortIdentification;
-  std::array<mpi::SendRequest<T>, capacity> requests;
+
+  ProgressEngine *progressEngine;
+  std::array<T, capacity> sendBuffers;
+  std::array<std::atomic<bool>, capacity> inFlight;
+  // Encoded tokens, by send buffer.
+  std::array<std::vector<char>, capacity> encodedBuffers;
+  // Credits granted by a remote destination.
+  CreditAccount *credits;
+  // Set up once per send buffer, see usePersistentRequests().
+  std::array<ProgressEngine::PersistentRequest, capacity> persistentSends;
+  bool isPersistent;
+  // Elements of vector tokens, zero if not fixed.
+  size_t messageSize;
+  // Slots of a remote destination that receives through RMA, which are
+  // filled in the order of the ring.
+  ProgressEngine::Ring ring;
+  std::atomic<bool> isRingLocated;
+  unsigned long long numPut;
+
+  T *reservedElement;
+  size_t reservedSlot;
+
+  // Handle to the channel of a local FanInPort, which is shared with the
+  // other sources of that port.
+  typename FanInChannel<T, capacity>::Producer *producer;
 
 public:
   template <class str>
-  explicit OutPort<T, capacity>(str &&name)
+  explicit OutPort(str &&name)
       : AbstractOutPort(std::forward<str>(name)),
-        otherPortIdentification(nullptr) {}
+        otherPortIdentification(nullptr), progressEngine(nullptr),
+        credits(nullptr), isPersistent(false), messageSize(0),
+        isRingLocated(false), numPut(0), reservedElement(nullptr),
+        reservedSlot(0), producer(nullptr) {
+    for (auto &isInFlight : inFlight)
+      isInFlight.store(false);
+  }
 
-  OutPort<T, capacity>(OutPort<T, capacity> const &) = delete;
-  OutPort<T, capacity>(OutPort<T, capacity> &&) = delete;
-  OutPort<T, capacity> &operator=(OutPort<T, capacity> const &) = delete;
-  OutPort<T, capacity> &operator=(OutPort<T, capacity> &&) = delete;
+  OutPort(OutPort const &) = delete;
+  OutPort(OutPort &&) = delete;
+  OutPort &operator=(OutPort const &) = delete;
+  OutPort &operator=(OutPort &&) = delete;
 
   void write(const T &);
   void write(T &&);
 
-  size_t freeCapacity() const;
+  // Constructs the element from args in the channel slot of a local
+  // destination or in the send buffer of a remote one.
+  template <class... Args> void emplace(Args &&... args);
+
+  // Writes in place: reserve() returns the slot the next element is
+  // constructed in, either in the channel of a local InPort or in a send
+  // buffer, and commit() passes it on. No other write may happen between
+  // the two.
+  T &reserve();
+
+  void commit();
+
+  // Sends to a remote port through a persistent request per send buffer.
+  // Vector tokens are given messageSize elements and send buffers keep
+  // their memory, so tokens written in place with reserve() reuse the
+  // request. Such tokens may hold at most messageSize elements and go
+  // without a header, so the destination has to be an InPort that declared
+  // the same size. Without a size, small vector tokens travel along with
+  // their header instead. Tokens for ranks that share memory, or that are
+  // aggregated, never use the request. Pays off for large messages, small
+  // ones are sent faster by MPI_Isend.
+  void usePersistentRequests(size_t messageSize = 0) {
+    isPersistent = true;
+    this->messageSize = messageSize;
+  }
+
+  // Writes count elements starting at source. A local destination is
+  // notified once for the whole batch.
+  template <class InputIt> InputIt write_n(InputIt source, size_t count);
+
+  size_t freeCapacity() const final;
 
   std::string toString() const final;
 
-  void
-  sendMessagesTo(PortIdentification<AbstractInPort> portIdentification) final {
+  void sendMessagesTo(PortIdentification<AbstractInPort> portIdentification,
+                      ProgressEngine *engine) final {
+    if (otherPortIdentification.isConnected())
+      throw std::runtime_error("OutPort " + getName() +
+                               " is already connected, use a "
+                               "MulticastOutPort to send to several "
+                               "destinations.");
     otherPortIdentification = portIdentification;
+    progressEngine = engine;
+    if (portIdentification.isExternal()) {
+      credits = engine->subscribeCredits(portIdentification.getRank(),
+                                         portIdentification.getTag(), this);
+      if (putsTokens()) {
+        if (mpi::is_dynamically_sized<T>::value)
+          throw std::runtime_error("OutPort " + getName() +
+                                   " cannot send tokens of varying size "
+                                   "through RMA.");
+        numPut = 0;
+        engine->locateRing(portIdentification.getRank(),
+                           portIdentification.getTag(), &ring, this,
+                           RING_SLOT);
+      }
+    } else if (portIdentification.getPort()->acceptsManySources())
+      producer = static_cast<FanInChannel<T, capacity> *>(
+                     portIdentification.getPort()->getChannel())
+                     ->attach();
   }
 
+  void disconnect(const PortIdentification<AbstractInPort> &) final;
+
+  void onRequestCompleted(size_t slot) final;
+
 private:
-  void recycleRequests();
+  // Completes once the ring of an RMA destination has been located.
+  static constexpr size_t RING_SLOT = capacity;
+
+  // Whether tokens are put into the channel of the remote destination.
+  bool putsTokens() const {
+    return otherPortIdentification.isExternal() &&
+           otherPortIdentification.getTransport() == Transport::RMA;
+  }
 
-  void preWrite() const;
+  void putToken(T &element);
 
-  void writeToLocal(const T &element);
-  void writeToLocal(T &&element);
+  bool encodesTokens() const {
+    return codec::is_enabled<Codec>::value &&
+           otherPortIdentification.isExternal() && !putsTokens() &&
+           !progressEngine->sharesMemoryWith(otherPortIdentification.getRank());
+  }
+
+  // Checks that count elements fit and takes their credits.
+  void preWrite(size_t count = 1);
+
+  // The slot of the next element, once preWrite made room for it.
+  T &reserveSlot();
+
+  size_t freeSendBuffers() const;
+
+  template <class U>
+  static void presize(std::vector<U> &buffer, size_t count) {
+    buffer.resize(count);
+  }
+
+  template <class U> static void presize(U &, size_t) {}
 
-  void writeToExternal(const T &element);
-  void writeToExternal(T &&element);
+  size_t acquireSendBuffer();
+
+  // Slots always hold an element. It is destroyed and constructed anew
+  // where construction cannot fail, and assigned a temporary otherwise.
+  template <class... Args>
+  static void construct(std::true_type, T &slot, Args &&... args);
+
+  template <class... Args>
+  static void construct(std::false_type, T &slot, Args &&... args);
+
+  // Calls operation with the typed channel of the local destination.
+  template <class Operation>
+  auto withLocalChannel(Operation &&operation) const;
 };
 
-template <typename T, int capacity>
-size_t OutPort<T, capacity>::freeCapacity() const {
-  return std::count_if(requests.begin(), requests.end(),
-                       [](const auto &request) { return !request.isDirty(); });
+template <typename T, int capacity, class Codec>
+size_t OutPort<T, capacity, Codec>::freeCapacity() const {
+  if (otherPortIdentification.isLocal())
+    return withLocalChannel(
+        [](auto channel) { return channel->freeCapacity(); });
+  if (putsTokens())
+    return isRingLocated.load(std::memory_order_acquire) ? credits->available()
+                                                         : 0;
+
+  return credits ? std::min(freeSendBuffers(), credits->available()) : 0;
 }
 
-template <typename T, int capacity>
-void OutPort<T, capacity>::recycleRequests() {
-  for (auto &request : requests) {
-    if (request.isDirty()) {
-      if (request.hasFinished())
-        request = mpi::SendRequest<T>();
-    }
+template <typename T, int capacity, class Codec>
+size_t OutPort<T, capacity, Codec>::freeSendBuffers() const {
+  return std::count_if(inFlight.begin(), inFlight.end(),
+                       [](const auto &isInFlight) { return !isInFlight; });
+}
+
+template <typename T, int capacity, class Codec>
+void OutPort<T, capacity, Codec>::disconnect(
+    const PortIdentification<AbstractInPort> &) {
+  for (auto &isInFlight : inFlight) {
+    if (isInFlight.load(std::memory_order_acquire))
+      throw std::runtime_error("Cannot disconnect a port with messages in "
+                               "flight.");
   }
+  if (producer) {
+    static_cast<FanInChannel<T, capacity> *>(
+        otherPortIdentification.getPort()->getChannel())
+        ->detach(producer);
+    producer = nullptr;
+  }
+  if (putsTokens() && !isRingLocated.load(std::memory_order_acquire))
+    progressEngine->cancel(this);
+  isRingLocated.store(false, std::memory_order_relaxed);
+  if (credits) {
+    progressEngine->unsubscribeCredits(credits, this);
+    credits = nullptr;
+  }
+  for (auto &request : persistentSends)
+    progressEngine->release(request);
+  otherPortIdentification = PortIdentification<AbstractInPort>(nullptr);
 }
 
-template <typename T, int capacity>
-void OutPort<T, capacity>::preWrite() const {
-  if (freeCapacity() == 0)
-    throw std::runtime_error("No free space in channel!");
+template <typename T, int capacity, class Codec>
+void OutPort<T, capacity, Codec>::onRequestCompleted(size_t slot) {
+  if (slot == RING_SLOT) {
+    isRingLocated.store(true, std::memory_order_release);
+    notifyOwner();
+    return;
+  }
+  if (!isPersistent)
+    mpi::recycle(sendBuffers[slot]);
+  mpi::recycle(encodedBuffers[slot]);
+  inFlight[slot].store(false, std::memory_order_release);
+  notifyOwner();
+}
+
+template <typename T, int capacity, class Codec>
+size_t OutPort<T, capacity, Codec>::acquireSendBuffer() {
+  for (size_t slot = 0; slot < capacity; slot++) {
+    if (!inFlight[slot].load(std::memory_order_acquire))
+      return slot;
+  }
+  throw std::runtime_error("No free send buffer.");
+}
 
+template <typename T, int capacity, class Codec>
+void OutPort<T, capacity, Codec>::preWrite(size_t count) {
   if (!otherPortIdentification.isConnected())
     throw std::runtime_error(
         "Unable to write to channel, channel not connected.");
+
+  // Another port sharing the credit account may have taken the credits
+  // since they were checked, the account's overdraft allows for that.
+  bool hasRoom;
+  if (otherPortIdentification.isLocal())
+    hasRoom = freeCapacity() >= count;
+  else if (putsTokens())
+    hasRoom = isRingLocated.load(std::memory_order_acquire) &&
+              credits->tryConsume(count);
+  else
+    hasRoom = freeSendBuffers() >= count && credits->tryConsume(count);
+  if (!hasRoom)
+    throw std::runtime_error("No free space in channel!");
 }
 
-template <typename T, int capacity>
-void OutPort<T, capacity>::write(const T &element) {
+template <typename T, int capacity, class Codec>
+T &OutPort<T, capacity, Codec>::reserve() {
+  if (reservedElement)
+    throw std::runtime_error("An element is already reserved.");
   preWrite();
+  return reserveSlot();
+}
 
+template <typename T, int capacity, class Codec>
+T &OutPort<T, capacity, Codec>::reserveSlot() {
   if (otherPortIdentification.isLocal()) {
-    writeToLocal(element);
+    reservedElement =
+        withLocalChannel([](auto channel) { return channel->reserve(); });
   } else {
-    writeToExternal(element);
+    reservedSlot = acquireSendBuffer();
+    reservedElement = &sendBuffers[reservedSlot];
+    if (messageSize > 0)
+      presize(*reservedElement, messageSize);
   }
+  return *reservedElement;
 }
-template <typename T, int capacity>
-void OutPort<T, capacity>::write(T &&element) {
-  preWrite();
+
+template <typename T, int capacity, class Codec>
+void OutPort<T, capacity, Codec>::commit() {
+  auto element = reservedElement;
+  if (!element)
+    throw std::runtime_error("No element has been reserved.");
+  reservedElement = nullptr;
 
   if (otherPortIdentification.isLocal()) {
-    writeToLocal(std::forward(element));
+    withLocalChannel([element](auto channel) { channel->commit(element); });
+    otherPortIdentification.getPort()->notifyOwner();
+  } else if (putsTokens()) {
+    putToken(sendBuffers[reservedSlot]);
+    progressEngine->countPuts(otherPortIdentification.getRank(), ring, 1);
   } else {
-    writeToExternal(std::forward(element));
+    auto transfer =
+        messageSize > 0
+            ? mpi::makeBoundedSend(otherPortIdentification.getRank(),
+                                   otherPortIdentification.getTag(),
+                                   sendBuffers[reservedSlot])
+            : mpi::makeSend(otherPortIdentification.getRank(),
+                            otherPortIdentification.getTag(),
+                            sendBuffers[reservedSlot]);
+    if (transfer.isBounded && static_cast<size_t>(transfer.count) > messageSize)
+      throw std::runtime_error("Token of OutPort " + getName() +
+                               " exceeds its message size.");
+    inFlight[reservedSlot].store(true, std::memory_order_relaxed);
+    if (encodesTokens()) {
+      codec::encode<Codec>(sendBuffers[reservedSlot],
+                           encodedBuffers[reservedSlot]);
+      progressEngine->submit(mpi::makeSend(otherPortIdentification.getRank(),
+                                           otherPortIdentification.getTag(),
+                                           encodedBuffers[reservedSlot]),
+                             this, reservedSlot);
+      return;
+    }
+    if (isPersistent)
+      progressEngine->submitPersistent(
+          transfer, persistentSends[reservedSlot], this, reservedSlot);
+    else
+      progressEngine->submit(transfer, this, reservedSlot);
   }
 }
 
-template <typename T, int capacity>
-void OutPort<T, capacity>::writeToLocal(const T &element) {
-  auto channel = static_cast<Channel<T, capacity> *>(
-      otherPortIdentification.getPort()->getChannel());
-  T *freeSpace = channel->reserve();
-  *freeSpace = element;
-  channel->returnElement(freeSpace);
+template <typename T, int capacity, class Codec>
+void OutPort<T, capacity, Codec>::putToken(T &element) {
+  auto transfer = mpi::makeSend(otherPortIdentification.getRank(),
+                                otherPortIdentification.getTag(), element);
+  auto index = (ring.first + numPut++) & (ring.numSlots - 1);
+  // The data of a token need not start at the token itself.
+  auto offset = static_cast<char *>(transfer.buffer) -
+                reinterpret_cast<char *>(&element);
+  progressEngine->put(transfer, ring.slots + static_cast<MPI_Aint>(
+                                                index * sizeof(T) + offset));
 }
 
-template <typename T, int capacity>
-void OutPort<T, capacity>::writeToLocal(T &&element) {
-  auto channel = static_cast<Channel<T, capacity> *>(
-      otherPortIdentification.getPort()->getChannel());
-  T *freeSpace = channel->reserve();
-  *freeSpace = std::move(element);
-  channel->returnElement(freeSpace);
+template <typename T, int capacity, class Codec>
+void OutPort<T, capacity, Codec>::write(const T &element) {
+  reserve() = element;
+  commit();
 }
 
-template <typename T, int capacity>
-void OutPort<T, capacity>::writeToExternal(const T &element) {
-  recycleRequests();
+template <typename T, int capacity, class Codec>
+void OutPort<T, capacity, Codec>::write(T &&element) {
+  reserve() = std::move(element);
+  commit();
+}
 
-  for (auto &request : requests) {
-    if (!request.isDirty()) {
-      request = mpi::SendRequest<T>(otherPortIdentification.getRank(),
-                                    otherPortIdentification.getTag(), element);
-      break;
-    }
-  }
+template <typename T, int capacity, class Codec>
+template <class... Args>
+void OutPort<T, capacity, Codec>::emplace(Args &&... args) {
+  construct(std::is_nothrow_constructible<T, Args &&...>(), reserve(),
+            std::forward<Args>(args)...);
+  commit();
+}
+
+template <typename T, int capacity, class Codec>
+template <class... Args>
+void OutPort<T, capacity, Codec>::construct(std::true_type, T &slot,
+                                     Args &&... args) {
+  slot.~T();
+  new (&slot) T(std::forward<Args>(args)...);
+}
+
+template <typename T, int capacity, class Codec>
+template <class... Args>
+void OutPort<T, capacity, Codec>::construct(std::false_type, T &slot,
+                                     Args &&... args) {
+  slot = T(std::forward<Args>(args)...);
 }
 
-template <typename T, int capacity>
-void OutPort<T, capacity>::writeToExternal(T &&element) {
-  recycleRequests();
+template <typename T, int capacity, class Codec>
+template <class InputIt>
+InputIt OutPort<T, capacity, Codec>::write_n(InputIt source, size_t count) {
+  preWrite(count);
 
-  auto &freeRequest =
-      find_if(requests.begin(), requests.end(),
-              [](const auto &request) { return !request.isDirty(); });
+  if (otherPortIdentification.isLocal()) {
+    source = withLocalChannel(
+        [&](auto channel) { return channel->putNext(source, count); });
+    otherPortIdentification.getPort()->notifyOwner();
+  } else if (putsTokens()) {
+    // Each token has a send buffer of its own until all are counted.
+    for (size_t i = 0; i < count; i++, ++source) {
+      sendBuffers[i] = *source;
+      putToken(sendBuffers[i]);
+    }
+    progressEngine->countPuts(otherPortIdentification.getRank(), ring, count);
+  } else {
+    // The credits of all elements have been taken already.
+    for (size_t i = 0; i < count; i++, ++source) {
+      reserveSlot() = *source;
+      commit();
+    }
+  }
+  return source;
+}
 
-  freeRequest = mpi::SendRequest<T>(otherPortIdentification.getRank(),
-                                    otherPortIdentification.getTag(),
-                                    std::forward(element));
+template <typename T, int capacity, class Codec>
+template <class Operation>
+auto OutPort<T, capacity, Codec>::withLocalChannel(
+    Operation &&operation) const {
+  if (producer)
+    return operation(producer);
+  return operation(static_cast<Channel<T, capacity> *>(
+      otherPortIdentification.getPort()->getChannel()));
 }
 
-template <typename T, int capacity>
-std::string OutPort<T, capacity>::toString() const {
+template <typename T, int capacity, class Codec>
+std::string OutPort<T, capacity, Codec>::toString() const {
   std::stringstream ss;
   ss << "[OP-" << capacity << " ID: " << myIdentification.getName() << "]";
   return ss.str();
@@ -5,22 +5,33 @@
 #ifndef ACTORUPCXX_PORT_H
 #define ACTORUPCXX_PORT_H
 
-#include "utils/helper.h"
 #include "utils/mpi_helper.hpp"
 #include <string>
 
+// How tokens travel between ports on different ranks.
+enum class Transport {
+  // Point-to-point messages, matched by the tag of the in port.
+  MESSAGES,
+  // One-sided puts into the channel of the in port. Only for InPorts with
+  // tokens of a fixed size.
+  RMA
+};
+
 template <typename T> class PortIdentification {
 public:
   PortIdentification() = delete;
 
+  // Messages of a remote connection carry the tag of its destination port.
   template <class str>
-  PortIdentification(str &&portName, mpi::rank rankId)
-      : portName(std::forward<str>(portName)),
-        tagIdentification(helper::compute_hash(portName)), rankId(rankId),
-        port(nullptr) {}
+  PortIdentification(str &&portName, mpi::rank rankId,
+                     mpi::tag messageTag = mpi::DEFAULT_TAG_ID,
+                     Transport transport = Transport::MESSAGES)
+      : portName(std::forward<str>(portName)), messageTag(messageTag),
+        rankId(rankId), transport(transport), port(nullptr) {}
 
   explicit PortIdentification(T *port)
-      : tagIdentification(0), rankId(mpi::INVALID_RANK_ID), port(port) {}
+      : messageTag(mpi::DEFAULT_TAG_ID), rankId(mpi::INVALID_RANK_ID),
+        transport(Transport::MESSAGES), port(port) {}
 
   inline bool isLocal() const { return port != nullptr; }
 
@@ -32,14 +43,24 @@ public:
 
   inline auto getName() const { return portName; }
 
-  inline auto getTag() const { return rankId; }
+  inline auto getTag() const { return messageTag; }
+
+  inline auto getTransport() const { return transport; }
 
   inline auto getPort() const { return port; }
 
+  inline bool operator==(const PortIdentification &other) const {
+    if (isLocal() || other.isLocal())
+      return port == other.port;
+    return rankId == other.rankId && messageTag == other.messageTag &&
+           portName == other.portName;
+  }
+
 private:
   std::string portName;
-  int tagIdentification;
+  mpi::tag messageTag;
   mpi::rank rankId;
+  Transport transport;
   T *port;
 };
 
@@ -0,0 +1,1468 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <thread>
+
+#include "CreditAccount.hpp"
+#include "ProgressEngine.hpp"
+
+using namespace std;
+
+namespace {
+// Batches travel on a communicator of their own, so a single tag suffices.
+constexpr mpi::tag BATCH_TAG = 0;
+
+// Data of messages of varying size up to this size travels along with
+// their header, larger data follows on its own.
+constexpr int EAGER_BYTES = 4096;
+
+// Marks the end of the data written before a mailbox wraps around.
+constexpr mpi::tag WRAP_TAG = -1;
+
+// Control messages in a mailbox are told apart by tags below WRAP_TAG.
+mpi::tag sharedTag(const mpi::Transfer &transfer) {
+  return transfer.isControl ? WRAP_TAG - 1 - transfer.messageTag
+                            : transfer.messageTag;
+}
+
+constexpr size_t MAILBOX_ALIGNMENT = 64;
+
+size_t alignTo(size_t size, size_t alignment) {
+  return (size + alignment - 1) / alignment * alignment;
+}
+
+// Returns the size of count elements of datatype if they are contiguous,
+// in which case they are copied as they are instead of being packed by
+// MPI, and -1 otherwise.
+int contiguousSize(int count, MPI_Datatype datatype) {
+  int size;
+  MPI_Aint lowerBound, extent;
+  MPI_Type_size(datatype, &size);
+  MPI_Type_get_true_extent(datatype, &lowerBound, &extent);
+  return lowerBound == 0 && extent == size ? count * size : -1;
+}
+} // namespace
+
+ProgressEngine::ProgressEngine()
+    : isAggregating(false), maxBatchBytes(0), maxBatchDelay(0),
+      numBatchedMessages(0), isExchanging(false),
+      neighbourCommunicator(MPI_COMM_NULL), numRounds(0), isSharing(false),
+      mailboxBytes(0), hasRemoteRanks(false), numBackloggedSends(0),
+      doorbell(nullptr), doorbellCommunicator(MPI_COMM_NULL),
+      doorbellRequest(MPI_REQUEST_NULL), windowCommunicator(MPI_COMM_NULL),
+      window(MPI_WIN_NULL), windowRank(0), isWindowUnified(false) {
+  MPI_Comm_dup(MPI_COMM_WORLD, &graphCommunicator);
+  MPI_Comm_dup(graphCommunicator, &controlCommunicator);
+  MPI_Comm_dup(graphCommunicator, &payloadCommunicator);
+  MPI_Comm_dup(graphCommunicator, &batchCommunicator);
+}
+
+ProgressEngine::~ProgressEngine() {
+  int isFinalized = 0;
+  MPI_Finalized(&isFinalized);
+  if (isFinalized)
+    return;
+
+  // Receives for slots that will never be filled are still pending.
+  for (auto &request : requests) {
+    MPI_Cancel(&request);
+    MPI_Request_free(&request);
+  }
+  for (auto &exposed : exposedRings) {
+    MPI_Win_detach(window, exposed->slots);
+    MPI_Win_detach(window, &exposed->tail);
+  }
+  if (hasWindow()) {
+    MPI_Win_unlock_all(window);
+    MPI_Win_free(&window);
+    MPI_Comm_free(&windowCommunicator);
+  }
+  if (isSharing) {
+    if (doorbellRequest != MPI_REQUEST_NULL) {
+      MPI_Cancel(&doorbellRequest);
+      MPI_Request_free(&doorbellRequest);
+    }
+    MPI_Comm_free(&doorbellCommunicator);
+    MPI_Win_unlock_all(sharedWindow);
+    MPI_Win_free(&sharedWindow);
+    MPI_Comm_free(&nodeCommunicator);
+    MPI_Comm_free(&sharedCommunicator);
+  }
+  if (neighbourCommunicator != MPI_COMM_NULL)
+    MPI_Comm_free(&neighbourCommunicator);
+  MPI_Comm_free(&controlCommunicator);
+  MPI_Comm_free(&payloadCommunicator);
+  MPI_Comm_free(&batchCommunicator);
+  MPI_Comm_free(&graphCommunicator);
+}
+
+MPI_Comm ProgressEngine::communicatorOf(const mpi::Transfer &transfer) const {
+  if (transfer.isControl)
+    return controlCommunicator;
+  // Of messages of varying size, only large payloads are sent as they are.
+  return transfer.hasVaryingSize ? payloadCommunicator : graphCommunicator;
+}
+
+void ProgressEngine::submit(const mpi::Transfer &transfer,
+                            RequestHandler *handler, size_t slot) {
+  if (isShared(transfer)) {
+    submitShared(transfer, handler, slot);
+    return;
+  }
+
+  MPI_Request request;
+  Completion completion{handler, slot,
+                        transfer.isSend ? RequestKind::SEND
+                                        : RequestKind::RECEIVE,
+                        transfer.peer};
+  lock_guard<mutex> lock(requestMutex);
+  if (isAggregating && !transfer.isControl) {
+    if (transfer.isSend)
+      pack(transfer, completion);
+    else
+      batchedReceives.push_back({transfer, completion});
+    return;
+  }
+
+  if (transfer.hasVaryingSize) {
+    if (!transfer.isSend) {
+      receiveHeader(transfer, completion);
+      return;
+    }
+    if (sendHeader(transfer, completion))
+      return;
+  }
+
+  // Credits keep the receivers from being flooded, so sends are eager.
+  if (transfer.isSend) {
+    numSent++;
+    numOutstandingSends++;
+    MPI_Isend(transfer.buffer, transfer.count, transfer.datatype,
+              transfer.peer, transfer.messageTag, communicatorOf(transfer),
+              &request);
+  } else {
+    MPI_Irecv(transfer.buffer, transfer.count, transfer.datatype,
+              transfer.peer, transfer.messageTag, communicatorOf(transfer),
+              &request);
+  }
+  requests.push_back(request);
+  completions.push_back(completion);
+}
+
+void ProgressEngine::submitPersistent(const mpi::Transfer &transfer,
+                                      PersistentRequest &request,
+                                      RequestHandler *handler, size_t slot) {
+  // Both sides of a bounded transfer fall back under the same conditions,
+  // so that it only goes without a header through persistent requests.
+  if (isAggregating || (transfer.resizeBuffer && !transfer.isBounded) ||
+      isShared(transfer)) {
+    submit(transfer, handler, slot);
+    return;
+  }
+
+  Completion completion{handler, slot,
+                        transfer.isSend ? RequestKind::SEND
+                                        : RequestKind::RECEIVE,
+                        transfer.peer};
+  lock_guard<mutex> lock(requestMutex);
+  // Small messages of varying size go along with their header, the
+  // request only sends the payloads of large ones.
+  if (transfer.hasVaryingSize && !transfer.isBounded &&
+      sendHeader(transfer, completion))
+    return;
+
+  if (request.buffer != transfer.buffer || request.count != transfer.count ||
+      request.request == MPI_REQUEST_NULL) {
+    if (request.request != MPI_REQUEST_NULL)
+      MPI_Request_free(&request.request);
+    if (transfer.isSend)
+      MPI_Send_init(transfer.buffer, transfer.count, transfer.datatype,
+                    transfer.peer, transfer.messageTag,
+                    communicatorOf(transfer), &request.request);
+    else
+      MPI_Recv_init(transfer.buffer, transfer.count, transfer.datatype,
+                    transfer.peer, transfer.messageTag,
+                    communicatorOf(transfer), &request.request);
+    request.buffer = transfer.buffer;
+    request.count = transfer.count;
+  }
+
+  if (transfer.isSend) {
+    numSent++;
+    numOutstandingSends++;
+  }
+  // The engine tracks a copy of the handle, which stays valid after the
+  // request has completed.
+  MPI_Start(&request.request);
+  requests.push_back(request.request);
+  if (transfer.isBounded && !transfer.isSend) {
+    // The buffer is cut to the count that arrived once it completes.
+    auto sizedSlot = acquireSizedSlot();
+    sizedReceives[sizedSlot].transfer = transfer;
+    sizedReceives[sizedSlot].completion = completion;
+    completions.push_back(
+        {handler, sizedSlot, RequestKind::BOUNDED, transfer.peer});
+  } else {
+    completions.push_back(completion);
+  }
+}
+
+void ProgressEngine::release(PersistentRequest &request) {
+  if (request.request == MPI_REQUEST_NULL)
+    return;
+  lock_guard<mutex> lock(requestMutex);
+  MPI_Request_free(&request.request);
+  request = PersistentRequest();
+}
+
+size_t ProgressEngine::progress() {
+  vector<Completion> completed;
+  {
+    unique_lock<mutex> lock(requestMutex, std::try_to_lock);
+    if (!lock.owns_lock())
+      return 0;
+
+    if (poll(completed) == 0)
+      return 0;
+  }
+
+  dispatch(completed);
+  return completed.size();
+}
+
+size_t ProgressEngine::waitForCompletion() {
+  vector<Completion> completed;
+  while (true) {
+    bool mustPoll;
+    {
+      lock_guard<mutex> lock(requestMutex);
+      sendBatches(false);
+      if (poll(completed) > 0)
+        break;
+      mustPoll = isPolling();
+      if (!mustPoll) {
+        if (requests.empty() && batchedReceives.empty())
+          return 0;
+        // A header or the doorbell may complete without a message.
+        if (block(completed) > 0)
+          break;
+      }
+    }
+    if (mustPoll)
+      std::this_thread::yield();
+  }
+
+  dispatch(completed);
+  return completed.size();
+}
+
+size_t ProgressEngine::block(vector<Completion> &completed) {
+  if (isSharing) {
+    // A message written before the doorbell was raised is found here, the
+    // sender of one written after it rings.
+    doorbell->isRaised.store(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (receiveShared(completed) > 0) {
+      doorbell->isRaised.store(0);
+      return completed.size();
+    }
+    if (doorbellRequest == MPI_REQUEST_NULL)
+      MPI_Irecv(nullptr, 0, MPI_BYTE, MPI_ANY_SOURCE, 0, doorbellCommunicator,
+                &doorbellRequest);
+    requests.push_back(doorbellRequest);
+  }
+
+  int numCompleted = 0;
+  completedIndices.resize(requests.size());
+  completedStatuses.resize(requests.size());
+  MPI_Waitsome(static_cast<int>(requests.size()), requests.data(),
+               &numCompleted, completedIndices.data(),
+               completedStatuses.data());
+
+  if (isSharing) {
+    // The doorbell is the last request and has no completion. It stays
+    // posted for the next wait unless it rang.
+    doorbell->isRaised.store(0);
+    int last = static_cast<int>(requests.size()) - 1;
+    doorbellRequest = requests.back();
+    requests.pop_back();
+    for (int i = 0; i < numCompleted; i++) {
+      if (completedIndices[i] != last)
+        continue;
+      completedIndices[i] = completedIndices[numCompleted - 1];
+      completedStatuses[i] = completedStatuses[numCompleted - 1];
+      numCompleted--;
+      break;
+    }
+  }
+  return complete(numCompleted, completed);
+}
+
+size_t ProgressEngine::poll(vector<Completion> &completed) {
+  if (isSharing) {
+    sendShared();
+    completed.insert(completed.end(), sharedCompletions.begin(),
+                     sharedCompletions.end());
+    sharedCompletions.clear();
+  }
+  if (isAggregating)
+    sendBatches(true);
+  // Earlier arrivals take the receives first.
+  if (isAggregating || isSharing)
+    matchArrivals(completed);
+  if (isAggregating)
+    receiveBatches(completed);
+  if (isExchanging) {
+    progressRound(completed);
+    if (round.request == MPI_REQUEST_NULL && isRoundDue(false))
+      startRound();
+  }
+  if (isSharing) {
+    receiveShared(completed);
+    matchRemote();
+  }
+  pollRings(completed);
+  testRequests(completed);
+  return completed.size();
+}
+
+bool ProgressEngine::isPolling() const {
+  // Neighbours wait for the rounds of this rank.
+  if (!exposedRings.empty() || numBackloggedSends > 0 ||
+      !sharedCompletions.empty() || isExchanging)
+    return true;
+  if (isAggregating)
+    return !batchedReceives.empty();
+  // Messages of other nodes are only found by MPI_Improbe.
+  return hasRemoteRanks &&
+         std::any_of(batchedReceives.begin(), batchedReceives.end(),
+                     [](const PendingReceive &receive) {
+                       return receive.transfer.peer == MPI_ANY_SOURCE;
+                     });
+}
+
+size_t ProgressEngine::testRequests(vector<Completion> &completed) {
+  if (requests.empty())
+    return 0;
+
+  int numCompleted = 0;
+  completedIndices.resize(requests.size());
+  completedStatuses.resize(requests.size());
+  MPI_Testsome(static_cast<int>(requests.size()), requests.data(),
+               &numCompleted, completedIndices.data(),
+               completedStatuses.data());
+  return complete(numCompleted, completed);
+}
+
+size_t ProgressEngine::complete(int numCompleted,
+                                vector<Completion> &completed) {
+  if (numCompleted == MPI_UNDEFINED || numCompleted == 0)
+    return 0;
+
+  for (int i = 0; i < numCompleted; i++) {
+    auto &completion = completions[completedIndices[i]];
+    auto source = completedStatuses[i].MPI_SOURCE;
+    if (completion.kind == RequestKind::HEADER) {
+      auto &receive = sizedReceives[completion.slot];
+      receive.hasArrived = true;
+      receive.completion.source = source;
+    } else if (completion.kind == RequestKind::BOUNDED) {
+      completeBounded(sizedReceives[completion.slot], completedStatuses[i]);
+    } else if (completion.kind == RequestKind::RECEIVE ||
+               completion.kind == RequestKind::PAYLOAD) {
+      completion.source = source;
+    }
+  }
+
+  // Remove back to front, so that swapping in the last entry never
+  // moves an index that is still to be removed.
+  std::sort(completedIndices.begin(), completedIndices.begin() + numCompleted,
+            std::greater<int>());
+  completed.reserve(completed.size() + numCompleted);
+  for (int i = 0; i < numCompleted; i++) {
+    auto index = completedIndices[i];
+    auto &completion = completions[index];
+    if (completion.kind == RequestKind::BATCH) {
+      auto &batch = sentBatches[completion.slot];
+      completed.insert(completed.end(), batch.messages.begin(),
+                       batch.messages.end());
+      mpi::recycle(batch.data);
+      batch.messages.clear();
+      freeBatchSlots.push_back(completion.slot);
+    } else if (completion.kind == RequestKind::HEADER) {
+      arrivedTags.push_back(sizedReceives[completion.slot].transfer.messageTag);
+    } else if (completion.kind == RequestKind::BOUNDED) {
+      completed.push_back(sizedReceives[completion.slot].completion);
+      freeSizedSlots.push_back(completion.slot);
+    } else {
+      completed.push_back(completion);
+      if (completion.kind == RequestKind::PAYLOAD)
+        completed.back().kind = RequestKind::RECEIVE;
+    }
+    remove(index);
+  }
+
+  // Headers are read once the requests are in place again, since reading
+  // them may post more.
+  for (auto messageTag : arrivedTags)
+    readHeaders(messageTag, completed);
+  arrivedTags.clear();
+  return completed.size();
+}
+
+void ProgressEngine::remove(size_t index) {
+  requests[index] = requests.back();
+  completions[index] = completions.back();
+  requests.pop_back();
+  completions.pop_back();
+}
+
+void ProgressEngine::cancel(RequestHandler *handler) {
+  vector<Completion> completed;
+  {
+    lock_guard<mutex> lock(requestMutex);
+    vector<mpi::tag> cancelledTags;
+    for (size_t index = requests.size(); index-- > 0;) {
+      auto completion = completions[index];
+      if (completion.handler != handler)
+        continue;
+
+      MPI_Status status;
+      // The header of a payload has been taken, so it has to be received.
+      if (completion.kind == RequestKind::PAYLOAD) {
+        MPI_Wait(&requests[index], &status);
+        completed.push_back(completion);
+        completed.back().kind = RequestKind::RECEIVE;
+        completed.back().source = status.MPI_SOURCE;
+        remove(index);
+        continue;
+      }
+
+      int isCancelled = 0;
+      MPI_Cancel(&requests[index]);
+      MPI_Wait(&requests[index], &status);
+      MPI_Test_cancelled(&status, &isCancelled);
+      if (completion.kind == RequestKind::HEADER) {
+        auto &receive = sizedReceives[completion.slot];
+        auto messageTag = receive.transfer.messageTag;
+        cancelledTags.push_back(messageTag);
+        if (!isCancelled) {
+          receive.hasArrived = true;
+          receive.completion.source = status.MPI_SOURCE;
+        } else {
+          auto &order = headerOrder[messageTag];
+          order.erase(std::find(order.begin(), order.end(), completion.slot));
+          mpi::recycle(receive.buffer);
+          freeSizedSlots.push_back(completion.slot);
+        }
+      } else if (completion.kind == RequestKind::BOUNDED) {
+        auto &receive = sizedReceives[completion.slot];
+        if (!isCancelled) {
+          completeBounded(receive, status);
+          completed.push_back(receive.completion);
+        }
+        freeSizedSlots.push_back(completion.slot);
+      } else if (!isCancelled) {
+        completed.push_back(completion);
+        completed.back().source = status.MPI_SOURCE;
+      } else if (completion.kind == RequestKind::SEND) {
+        numSent--;
+        numOutstandingSends--;
+      }
+      remove(index);
+    }
+    for (auto messageTag : cancelledTags)
+      readHeaders(messageTag, completed, true);
+
+    // Batched receives have not taken a message yet, so there is nothing
+    // to cancel.
+    auto isOfHandler = [handler](const PendingReceive &receive) {
+      return receive.completion.handler == handler;
+    };
+    batchedReceives.erase(std::remove_if(batchedReceives.begin(),
+                                         batchedReceives.end(), isOfHandler),
+                          batchedReceives.end());
+
+    // Sends still waiting for room have not been counted yet, those in a
+    // mailbox have completed.
+    for (auto &entry : sharedBacklog) {
+      auto &backlog = entry.second;
+      auto end = std::remove_if(backlog.begin(), backlog.end(),
+                                [handler](const SharedSend &send) {
+                                  return send.completion.handler == handler;
+                                });
+      numBackloggedSends -= backlog.end() - end;
+      backlog.erase(end, backlog.end());
+    }
+    auto isCompleted = [handler](const Completion &completion) {
+      return completion.handler == handler;
+    };
+    std::copy_if(sharedCompletions.begin(), sharedCompletions.end(),
+                 std::back_inserter(completed), isCompleted);
+    sharedCompletions.erase(std::remove_if(sharedCompletions.begin(),
+                                           sharedCompletions.end(),
+                                           isCompleted),
+                            sharedCompletions.end());
+  }
+
+  dispatch(completed);
+}
+
+void ProgressEngine::dispatch(const vector<Completion> &completed) {
+  // Handlers may submit again, so they run without holding the lock. The
+  // counters are updated afterwards, so that an actor notified by a handler
+  // is already queued once the message shows up in them.
+  for (auto &completion : completed) {
+    if (completion.kind == RequestKind::RECEIVE)
+      completion.handler->onReceiveCompleted(completion.slot,
+                                             completion.source);
+    else
+      completion.handler->onRequestCompleted(completion.slot);
+    if (completion.kind == RequestKind::SEND)
+      numOutstandingSends--;
+    else if (completion.kind == RequestKind::RECEIVE)
+      numReceived++;
+  }
+}
+
+size_t ProgressEngine::outstanding() const {
+  lock_guard<mutex> lock(requestMutex);
+  return requests.size() + batchedReceives.size() +
+         numBatchedMessages + exposedRings.size() + numBackloggedSends +
+         sharedCompletions.size() + round.messages.size() +
+         (isExchanging ? 1 : 0);
+}
+
+void ProgressEngine::enableAggregation(size_t maxBytes,
+                                       std::chrono::microseconds maxDelay) {
+  lock_guard<mutex> lock(requestMutex);
+  isAggregating = true;
+  maxBatchBytes = maxBytes;
+  maxBatchDelay = maxDelay;
+}
+
+void ProgressEngine::flush() {
+  if (!isAggregating)
+    return;
+  lock_guard<mutex> lock(requestMutex);
+  sendBatches(false);
+  if (isExchanging && round.request == MPI_REQUEST_NULL && isRoundDue(true))
+    startRound();
+}
+
+void ProgressEngine::pack(const mpi::Transfer &transfer,
+                          const Completion &completion) {
+  auto &batch = batches[transfer.peer];
+  if (batch.messages.empty()) {
+    batch.since = chrono::steady_clock::now();
+    if (batch.data.capacity() == 0)
+      batch.data = pool::SizeClassPool<char>::instance().acquire(maxBatchBytes);
+    batch.data.clear();
+  }
+
+  MessageHeader header{transfer.messageTag, transfer.count,
+                       packedSize(transfer)};
+  auto offset = batch.data.size();
+  batch.data.resize(offset + sizeof(header) + header.size);
+  header.size = packData(
+      transfer, batch.data.data() + offset + sizeof(header), header.size);
+  memcpy(batch.data.data() + offset, &header, sizeof(header));
+  batch.data.resize(offset + sizeof(header) + header.size);
+
+  batch.messages.push_back(completion);
+  numBatchedMessages++;
+  numSent++;
+  numOutstandingSends++;
+  if (batch.data.size() >= maxBatchBytes && !isNeighbour(transfer.peer))
+    sendBatch(transfer.peer, batch);
+}
+
+int ProgressEngine::packedSize(const mpi::Transfer &transfer) const {
+  auto size = contiguousSize(transfer.count, transfer.datatype);
+  if (size < 0)
+    MPI_Pack_size(transfer.count, transfer.datatype, batchCommunicator,
+                  &size);
+  return size;
+}
+
+int ProgressEngine::packData(const mpi::Transfer &transfer, char *data,
+                             int size) const {
+  if (contiguousSize(transfer.count, transfer.datatype) >= 0) {
+    memcpy(data, transfer.buffer, size);
+    return size;
+  }
+  int position = 0;
+  MPI_Pack(transfer.buffer, transfer.count, transfer.datatype, data, size,
+           &position, batchCommunicator);
+  return position;
+}
+
+void ProgressEngine::unpackData(const MessageHeader &header, const char *data,
+                                void *buffer, MPI_Datatype datatype) const {
+  if (contiguousSize(header.count, datatype) >= 0) {
+    memcpy(buffer, data, header.size);
+    return;
+  }
+  int position = 0;
+  MPI_Unpack(data, header.size, &position, buffer, header.count, datatype,
+             batchCommunicator);
+}
+
+bool ProgressEngine::sendHeader(const mpi::Transfer &transfer,
+                                const Completion &completion) {
+  auto size = packedSize(transfer);
+  bool hasData = size <= EAGER_BYTES;
+  MessageHeader header{transfer.messageTag, transfer.count, -1};
+  auto slot = acquireBatchSlot();
+  auto &sent = sentBatches[slot];
+  sent.data = pool::SizeClassPool<char>::instance().acquire(
+      sizeof(header) + (hasData ? size : 0));
+  if (hasData) {
+    header.size = packData(transfer, sent.data.data() + sizeof(header), size);
+    sent.data.resize(sizeof(header) + header.size);
+    sent.messages.push_back(completion);
+    numSent++;
+    numOutstandingSends++;
+  }
+  memcpy(sent.data.data(), &header, sizeof(header));
+
+  // The header is kept and sent like a batch, it completes the send of
+  // the data it holds.
+  MPI_Request request;
+  MPI_Isend(sent.data.data(), static_cast<int>(sent.data.size()), MPI_BYTE,
+            transfer.peer, transfer.messageTag, graphCommunicator, &request);
+  requests.push_back(request);
+  completions.push_back({nullptr, slot, RequestKind::BATCH, transfer.peer});
+  return hasData;
+}
+
+size_t ProgressEngine::acquireSizedSlot() {
+  if (freeSizedSlots.empty()) {
+    sizedReceives.emplace_back();
+    return sizedReceives.size() - 1;
+  }
+  auto slot = freeSizedSlots.back();
+  freeSizedSlots.pop_back();
+  return slot;
+}
+
+void ProgressEngine::completeBounded(SizedReceive &receive,
+                                     const MPI_Status &status) {
+  int count = 0;
+  MPI_Get_count(&status, receive.transfer.datatype, &count);
+  receive.transfer.resizeBuffer(count);
+  receive.completion.source = status.MPI_SOURCE;
+}
+
+void ProgressEngine::receiveHeader(const mpi::Transfer &transfer,
+                                   const Completion &completion,
+                                   MPI_Message *message) {
+  auto slot = acquireSizedSlot();
+  auto &receive = sizedReceives[slot];
+  receive.transfer = transfer;
+  receive.completion = completion;
+  receive.hasArrived = false;
+  int size = static_cast<int>(sizeof(MessageHeader)) + EAGER_BYTES;
+  receive.buffer = pool::SizeClassPool<char>::instance().acquire(size);
+
+  MPI_Request request;
+  if (message)
+    MPI_Imrecv(receive.buffer.data(), size, MPI_BYTE, message, &request);
+  else
+    MPI_Irecv(receive.buffer.data(), size, MPI_BYTE, transfer.peer,
+              transfer.messageTag, graphCommunicator, &request);
+  requests.push_back(request);
+  completions.push_back(
+      {completion.handler, slot, RequestKind::HEADER, transfer.peer});
+  headerOrder[transfer.messageTag].push_back(slot);
+}
+
+void ProgressEngine::readHeaders(mpi::tag messageTag,
+                                 vector<Completion> &completed,
+                                 bool isCancelling) {
+  auto order = headerOrder.find(messageTag);
+  if (order == headerOrder.end())
+    return;
+
+  auto &slots = order->second;
+  while (!slots.empty() && sizedReceives[slots.front()].hasArrived) {
+    auto slot = slots.front();
+    slots.pop_front();
+    auto &receive = sizedReceives[slot];
+    auto &transfer = receive.transfer;
+    auto source = receive.completion.source;
+    MessageHeader header;
+    memcpy(&header, receive.buffer.data(), sizeof(header));
+    void *buffer = transfer.resizeBuffer(header.count);
+    if (header.size >= 0) {
+      unpackData(header, receive.buffer.data() + sizeof(header), buffer,
+                 transfer.datatype);
+      completed.push_back(receive.completion);
+    } else if (isCancelling) {
+      MPI_Recv(buffer, header.count, transfer.datatype, source, messageTag,
+               payloadCommunicator, MPI_STATUS_IGNORE);
+      completed.push_back(receive.completion);
+    } else {
+      MPI_Request request;
+      MPI_Irecv(buffer, header.count, transfer.datatype, source, messageTag,
+                payloadCommunicator, &request);
+      requests.push_back(request);
+      completions.push_back(receive.completion);
+      completions.back().kind = RequestKind::PAYLOAD;
+    }
+    mpi::recycle(receive.buffer);
+    freeSizedSlots.push_back(slot);
+  }
+  if (slots.empty())
+    headerOrder.erase(order);
+}
+
+void ProgressEngine::sendBatches(bool onlyExpired) {
+  auto now = chrono::steady_clock::now();
+  for (auto &entry : batches) {
+    auto &batch = entry.second;
+    if (batch.messages.empty() || isNeighbour(entry.first) ||
+        (onlyExpired && now - batch.since < maxBatchDelay))
+      continue;
+    sendBatch(entry.first, batch);
+  }
+}
+
+size_t ProgressEngine::acquireBatchSlot() {
+  if (freeBatchSlots.empty()) {
+    sentBatches.emplace_back();
+    return sentBatches.size() - 1;
+  }
+  auto slot = freeBatchSlots.back();
+  freeBatchSlots.pop_back();
+  return slot;
+}
+
+void ProgressEngine::sendBatch(mpi::rank peer, Batch &batch) {
+  auto slot = acquireBatchSlot();
+  numBatchedMessages -= batch.messages.size();
+  auto &sent = sentBatches[slot];
+  std::swap(sent.data, batch.data);
+  std::swap(sent.messages, batch.messages);
+
+  MPI_Request request;
+  MPI_Isend(sent.data.data(), static_cast<int>(sent.data.size()), MPI_BYTE,
+            peer, BATCH_TAG, batchCommunicator, &request);
+  requests.push_back(request);
+  completions.push_back({nullptr, slot, RequestKind::BATCH, peer});
+}
+
+size_t ProgressEngine::receiveBatches(vector<Completion> &completed) {
+  auto &buffers = pool::SizeClassPool<char>::instance();
+  size_t numBatches = 0;
+  while (true) {
+    int isMatched = 0;
+    MPI_Message message;
+    MPI_Status status;
+    MPI_Improbe(MPI_ANY_SOURCE, BATCH_TAG, batchCommunicator, &isMatched,
+                &message, &status);
+    if (!isMatched)
+      return numBatches;
+
+    int size = 0;
+    MPI_Get_count(&status, MPI_BYTE, &size);
+    auto data = buffers.acquire(size);
+    MPI_Mrecv(data.data(), size, MPI_BYTE, &message, MPI_STATUS_IGNORE);
+    unpack(status.MPI_SOURCE, data.data(), data.size(), completed);
+    buffers.release(std::move(data));
+    numBatches++;
+  }
+}
+
+void ProgressEngine::unpack(mpi::rank source, const char *data, size_t size,
+                            vector<Completion> &completed) {
+  size_t offset = 0;
+  while (offset < size) {
+    MessageHeader header;
+    memcpy(&header, data + offset, sizeof(header));
+    offset += sizeof(header);
+    const char *payload = data + offset;
+    if (!deliver(source, header, payload, completed))
+      arrivals.push_back(
+          {source, header, vector<char>(payload, payload + header.size)});
+    offset += header.size;
+  }
+}
+
+void ProgressEngine::exchangeWithNeighbours(
+    const map<mpi::rank, int> &sources,
+    const map<mpi::rank, int> &destinations) {
+  lock_guard<mutex> lock(requestMutex);
+  if (!isAggregating)
+    throw std::runtime_error("Batches are only exchanged with neighbours "
+                             "while messages are aggregated.");
+
+  vector<int> sourceWeights;
+  vector<int> destinationWeights;
+  sourceRanks.clear();
+  destinationRanks.clear();
+  for (auto &source : sources) {
+    if (sharesMemoryWith(source.first))
+      continue;
+    sourceRanks.push_back(source.first);
+    sourceWeights.push_back(source.second);
+  }
+  for (auto &destination : destinations) {
+    if (sharesMemoryWith(destination.first))
+      continue;
+    destinationRanks.push_back(destination.first);
+    destinationWeights.push_back(destination.second);
+  }
+
+  if (neighbourCommunicator != MPI_COMM_NULL)
+    MPI_Comm_free(&neighbourCommunicator);
+  // Rounds are not worth it while all ranks share memory.
+  int hasNeighbours = !sourceRanks.empty() || !destinationRanks.empty();
+  MPI_Allreduce(MPI_IN_PLACE, &hasNeighbours, 1, MPI_INT, MPI_LOR,
+                graphCommunicator);
+  if (!hasNeighbours)
+    return;
+
+  // Every actor is bound to its rank, so the ranks are kept as they are.
+  MPI_Dist_graph_create_adjacent(
+      graphCommunicator, static_cast<int>(sourceRanks.size()),
+      sourceRanks.data(), sourceWeights.data(),
+      static_cast<int>(destinationRanks.size()), destinationRanks.data(),
+      destinationWeights.data(), MPI_INFO_NULL, 0, &neighbourCommunicator);
+  isExchanging = true;
+  round.since = chrono::steady_clock::now();
+}
+
+void ProgressEngine::finishExchange() {
+  vector<Completion> completed;
+  {
+    lock_guard<mutex> lock(requestMutex);
+    if (!isExchanging)
+      return;
+
+    // Collectives have to be called as often on every rank, and the
+    // running round may wait for ranks that have stopped already.
+    auto numStarted = numRounds;
+    unsigned long long numRequired = 0;
+    MPI_Request request;
+    MPI_Iallreduce(&numStarted, &numRequired, 1, MPI_UNSIGNED_LONG_LONG,
+                   MPI_MAX, graphCommunicator, &request);
+    int isDone = 0;
+    while (!isDone) {
+      progressRound(completed);
+      MPI_Test(&request, &isDone, MPI_STATUS_IGNORE);
+    }
+    while (numRounds < numRequired || round.request != MPI_REQUEST_NULL) {
+      if (round.request == MPI_REQUEST_NULL)
+        startRound();
+      progressRound(completed);
+    }
+    isExchanging = false;
+  }
+
+  dispatch(completed);
+}
+
+bool ProgressEngine::isNeighbour(mpi::rank peer) const {
+  return isExchanging && std::binary_search(destinationRanks.begin(),
+                                            destinationRanks.end(), peer);
+}
+
+bool ProgressEngine::isRoundDue(bool isFlushing) const {
+  if (chrono::steady_clock::now() - round.since >= maxBatchDelay)
+    return true;
+  for (auto peer : destinationRanks) {
+    auto entry = batches.find(peer);
+    if (entry == batches.end())
+      continue;
+    auto &batch = entry->second;
+    if (isFlushing ? !batch.messages.empty()
+                   : batch.data.size() >= maxBatchBytes)
+      return true;
+  }
+  return false;
+}
+
+void ProgressEngine::startRound() {
+  auto numDestinations = destinationRanks.size();
+  round.sendSizes.assign(numDestinations, 0);
+  round.sendOffsets.assign(numDestinations, 0);
+  round.sendData.clear();
+  for (size_t i = 0; i < numDestinations; i++) {
+    round.sendOffsets[i] = static_cast<int>(round.sendData.size());
+    auto entry = batches.find(destinationRanks[i]);
+    if (entry == batches.end() || entry->second.messages.empty())
+      continue;
+
+    auto &batch = entry->second;
+    round.sendData.insert(round.sendData.end(), batch.data.begin(),
+                          batch.data.end());
+    round.sendSizes[i] = static_cast<int>(batch.data.size());
+    round.messages.insert(round.messages.end(), batch.messages.begin(),
+                          batch.messages.end());
+    numBatchedMessages -= batch.messages.size();
+    batch.messages.clear();
+    batch.data.clear();
+  }
+
+  round.receiveSizes.assign(sourceRanks.size(), 0);
+  round.hasSizes = false;
+  round.since = chrono::steady_clock::now();
+  MPI_Ineighbor_alltoall(round.sendSizes.data(), 1, MPI_INT,
+                         round.receiveSizes.data(), 1, MPI_INT,
+                         neighbourCommunicator, &round.request);
+  numRounds++;
+}
+
+size_t ProgressEngine::progressRound(vector<Completion> &completed) {
+  if (round.request == MPI_REQUEST_NULL)
+    return 0;
+
+  int isDone = 0;
+  MPI_Test(&round.request, &isDone, MPI_STATUS_IGNORE);
+  if (!isDone)
+    return 0;
+
+  if (!round.hasSizes) {
+    round.hasSizes = true;
+    round.receiveOffsets.resize(sourceRanks.size());
+    int size = 0;
+    for (size_t i = 0; i < sourceRanks.size(); i++) {
+      round.receiveOffsets[i] = size;
+      size += round.receiveSizes[i];
+    }
+    round.receiveData.resize(size);
+    MPI_Ineighbor_alltoallv(
+        round.sendData.data(), round.sendSizes.data(),
+        round.sendOffsets.data(), MPI_BYTE, round.receiveData.data(),
+        round.receiveSizes.data(), round.receiveOffsets.data(), MPI_BYTE,
+        neighbourCommunicator, &round.request);
+    return 0;
+  }
+
+  auto numCompleted = completed.size();
+  completed.insert(completed.end(), round.messages.begin(),
+                   round.messages.end());
+  round.messages.clear();
+  for (size_t i = 0; i < sourceRanks.size(); i++)
+    unpack(sourceRanks[i], round.receiveData.data() + round.receiveOffsets[i],
+           round.receiveSizes[i], completed);
+  return completed.size() - numCompleted;
+}
+
+size_t ProgressEngine::matchArrivals(vector<Completion> &completed) {
+  size_t numMatched = 0;
+  auto arrival = arrivals.begin();
+  while (arrival != arrivals.end() && !batchedReceives.empty()) {
+    if (deliver(arrival->source, arrival->header, arrival->data.data(),
+                completed)) {
+      arrival = arrivals.erase(arrival);
+      numMatched++;
+    } else {
+      ++arrival;
+    }
+  }
+  return numMatched;
+}
+
+bool ProgressEngine::deliver(mpi::rank source, const MessageHeader &header,
+                             const char *data, vector<Completion> &completed) {
+  auto receive = std::find_if(
+      batchedReceives.begin(), batchedReceives.end(),
+      [source, &header](const PendingReceive &candidate) {
+        auto &transfer = candidate.transfer;
+        return transfer.messageTag == header.messageTag &&
+               (transfer.peer == source || transfer.peer == MPI_ANY_SOURCE);
+      });
+  if (receive == batchedReceives.end())
+    return false;
+
+  auto &transfer = receive->transfer;
+  void *buffer = transfer.buffer;
+  if (transfer.resizeBuffer)
+    buffer = transfer.resizeBuffer(header.count);
+  else if (header.count > transfer.count)
+    throw std::runtime_error("Batched message does not fit its receive.");
+
+  // Only the header of a message too large for its mailbox was in there.
+  if (header.size < 0) {
+    MPI_Recv(buffer, header.count, transfer.datatype, source,
+             header.messageTag, sharedCommunicator, MPI_STATUS_IGNORE);
+  } else {
+    unpackData(header, data, buffer, transfer.datatype);
+  }
+  completed.push_back(receive->completion);
+  completed.back().source = source;
+  batchedReceives.erase(receive);
+  return true;
+}
+
+void ProgressEngine::enableSharedMemory(size_t mailboxBytes) {
+  lock_guard<mutex> lock(requestMutex);
+  MPI_Comm_split_type(graphCommunicator, MPI_COMM_TYPE_SHARED, 0,
+                      MPI_INFO_NULL, &nodeCommunicator);
+  int nodeSize, nodeRank, worldSize;
+  MPI_Comm_size(nodeCommunicator, &nodeSize);
+  MPI_Comm_rank(nodeCommunicator, &nodeRank);
+  MPI_Comm_size(graphCommunicator, &worldSize);
+  if (nodeSize == 1) {
+    MPI_Comm_free(&nodeCommunicator);
+    return;
+  }
+
+  nodeRanks.resize(worldSize);
+  worldRanks.resize(nodeSize);
+  vector<int> allRanks(worldSize);
+  for (int rank = 0; rank < worldSize; rank++)
+    allRanks[rank] = rank;
+  MPI_Group worldGroup, nodeGroup;
+  MPI_Comm_group(graphCommunicator, &worldGroup);
+  MPI_Comm_group(nodeCommunicator, &nodeGroup);
+  MPI_Group_translate_ranks(worldGroup, worldSize, allRanks.data(), nodeGroup,
+                            nodeRanks.data());
+  MPI_Group_free(&worldGroup);
+  MPI_Group_free(&nodeGroup);
+  for (int rank = 0; rank < worldSize; rank++) {
+    if (nodeRanks[rank] == MPI_UNDEFINED)
+      nodeRanks[rank] = -1;
+    else
+      worldRanks[nodeRanks[rank]] = rank;
+  }
+  hasRemoteRanks = nodeSize < worldSize;
+
+  // Every rank holds its doorbell and the mailboxes to it, one per rank on
+  // the node, in memory close to itself.
+  this->mailboxBytes = alignTo(mailboxBytes, MAILBOX_ALIGNMENT);
+  auto stride = sizeof(Mailbox) + this->mailboxBytes;
+  auto first = sizeof(Doorbell);
+  MPI_Info info;
+  MPI_Info_create(&info);
+  MPI_Info_set(info, "alloc_shared_noncontig", "true");
+  char *segment = nullptr;
+  MPI_Win_allocate_shared(static_cast<MPI_Aint>(first + stride * nodeSize), 1,
+                          info,
+                          nodeCommunicator, &segment, &sharedWindow);
+  MPI_Info_free(&info);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, sharedWindow);
+  doorbell = new (segment) Doorbell;
+  doorbell->isRaised.store(0, std::memory_order_relaxed);
+  for (int sender = 0; sender < nodeSize; sender++) {
+    auto mailbox = new (segment + first + sender * stride) Mailbox;
+    mailbox->head.store(0, std::memory_order_relaxed);
+    mailbox->tail.store(0, std::memory_order_relaxed);
+  }
+  MPI_Win_sync(sharedWindow);
+  MPI_Barrier(nodeCommunicator);
+  MPI_Win_sync(sharedWindow);
+
+  inbox.resize(nodeSize);
+  outbox.resize(nodeSize);
+  doorbells.resize(nodeSize);
+  for (int peer = 0; peer < nodeSize; peer++) {
+    MPI_Aint size;
+    int unit;
+    char *peerSegment;
+    MPI_Win_shared_query(sharedWindow, peer, &size, &unit, &peerSegment);
+    inbox[peer] = reinterpret_cast<Mailbox *>(segment + first + peer * stride);
+    outbox[peer] = reinterpret_cast<Mailbox *>(peerSegment + first +
+                                               nodeRank * stride);
+    doorbells[peer] = reinterpret_cast<Doorbell *>(peerSegment);
+  }
+  MPI_Comm_dup(graphCommunicator, &sharedCommunicator);
+  MPI_Comm_dup(graphCommunicator, &doorbellCommunicator);
+  isSharing = true;
+}
+
+void ProgressEngine::submitShared(const mpi::Transfer &transfer,
+                                  RequestHandler *handler, size_t slot) {
+  auto shared = transfer;
+  shared.messageTag = sharedTag(transfer);
+  vector<Completion> completed;
+  {
+    lock_guard<mutex> lock(requestMutex);
+    Completion completion{handler, slot,
+                          transfer.isSend ? RequestKind::SEND
+                                          : RequestKind::RECEIVE,
+                          transfer.peer};
+    if (!transfer.isSend) {
+      batchedReceives.push_back({shared, completion});
+      return;
+    }
+
+    // Later sends must not overtake the ones that wait for room.
+    auto &backlog = sharedBacklog[transfer.peer];
+    if (!backlog.empty() || !putShared(shared, completion)) {
+      backlog.push_back({shared, completion});
+      numBackloggedSends++;
+    }
+    completed.swap(sharedCompletions);
+  }
+
+  // A message in a mailbox has been copied, so its buffer is free again.
+  dispatch(completed);
+}
+
+bool ProgressEngine::isShared(const mpi::Transfer &transfer) const {
+  if (!isSharing)
+    return false;
+  if (transfer.peer == MPI_ANY_SOURCE)
+    return !transfer.isSend && !transfer.isControl;
+  return sharesMemoryWith(transfer.peer);
+}
+
+bool ProgressEngine::putShared(const mpi::Transfer &transfer,
+                               const Completion &completion) {
+  auto mailbox = outbox[nodeRanks[transfer.peer]];
+  auto data = reinterpret_cast<char *>(mailbox + 1);
+  auto size = packedSize(transfer);
+  bool isSeparate =
+      !transfer.isControl && static_cast<size_t>(size) > mailboxBytes / 4;
+  auto recordSize = alignTo(sizeof(MessageHeader) + (isSeparate ? 0 : size),
+                            sizeof(long));
+
+  // Records do not wrap around, the space left at the end is skipped.
+  auto tail = mailbox->tail.load(std::memory_order_relaxed);
+  auto offset = tail % mailboxBytes;
+  size_t skipped =
+      offset + recordSize > mailboxBytes ? mailboxBytes - offset : 0;
+  if (tail + skipped + recordSize -
+          mailbox->head.load(std::memory_order_acquire) >
+      mailboxBytes)
+    return false;
+
+  if (skipped >= sizeof(MessageHeader)) {
+    MessageHeader wrap{WRAP_TAG, 0, 0};
+    memcpy(data + offset, &wrap, sizeof(wrap));
+  }
+  tail += skipped;
+  offset = tail % mailboxBytes;
+
+  numSent++;
+  numOutstandingSends++;
+  MessageHeader header{transfer.messageTag, transfer.count, -1};
+  if (isSeparate) {
+    MPI_Request request;
+    MPI_Isend(transfer.buffer, transfer.count, transfer.datatype,
+              transfer.peer, transfer.messageTag, sharedCommunicator,
+              &request);
+    requests.push_back(request);
+    completions.push_back(completion);
+  } else {
+    header.size = packData(transfer, data + offset + sizeof(header), size);
+    sharedCompletions.push_back(completion);
+  }
+  memcpy(data + offset, &header, sizeof(header));
+  mailbox->tail.store(tail + recordSize, std::memory_order_release);
+  ring(transfer.peer);
+  return true;
+}
+
+void ProgressEngine::ring(mpi::rank peer) {
+  // Pairs with the fence in block(), so that either the peer sees the
+  // message or this rank sees the raised doorbell.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  auto &isRaised = doorbells[nodeRanks[peer]]->isRaised;
+  if (!isRaised.load(std::memory_order_relaxed) || !isRaised.exchange(0))
+    return;
+
+  // Nothing waits for the empty message, it is sent eagerly.
+  MPI_Request request;
+  MPI_Isend(nullptr, 0, MPI_BYTE, peer, 0, doorbellCommunicator, &request);
+  MPI_Request_free(&request);
+}
+
+void ProgressEngine::sendShared() {
+  if (numBackloggedSends == 0)
+    return;
+  for (auto &entry : sharedBacklog) {
+    auto &backlog = entry.second;
+    while (!backlog.empty() &&
+           putShared(backlog.front().transfer, backlog.front().completion)) {
+      backlog.pop_front();
+      numBackloggedSends--;
+    }
+  }
+}
+
+size_t ProgressEngine::receiveShared(vector<Completion> &completed) {
+  size_t numMessages = 0;
+  for (size_t sender = 0; sender < inbox.size(); sender++) {
+    auto mailbox = inbox[sender];
+    auto data = reinterpret_cast<const char *>(mailbox + 1);
+    auto head = mailbox->head.load(std::memory_order_relaxed);
+    auto tail = mailbox->tail.load(std::memory_order_acquire);
+    while (head != tail) {
+      auto offset = head % mailboxBytes;
+      MessageHeader header;
+      if (mailboxBytes - offset >= sizeof(header))
+        memcpy(&header, data + offset, sizeof(header));
+      if (mailboxBytes - offset < sizeof(header) ||
+          header.messageTag == WRAP_TAG) {
+        head += mailboxBytes - offset;
+        continue;
+      }
+
+      auto source = worldRanks[sender];
+      const char *payload = data + offset + sizeof(header);
+      auto size = static_cast<size_t>(std::max(header.size, 0));
+      if (!deliver(source, header, payload, completed))
+        arrivals.push_back(
+            {source, header, vector<char>(payload, payload + size)});
+      head += alignTo(sizeof(header) + size, sizeof(long));
+      mailbox->head.store(head, std::memory_order_release);
+      numMessages++;
+    }
+  }
+  return numMessages;
+}
+
+size_t ProgressEngine::matchRemote() {
+  // Batches bring the messages of other nodes while aggregating.
+  if (!hasRemoteRanks || isAggregating)
+    return 0;
+
+  size_t numMatched = 0;
+  vector<mpi::tag> unmatched;
+  auto receive = batchedReceives.begin();
+  while (receive != batchedReceives.end()) {
+    auto &transfer = receive->transfer;
+    if (transfer.peer != MPI_ANY_SOURCE ||
+        find(unmatched.begin(), unmatched.end(), transfer.messageTag) !=
+            unmatched.end()) {
+      ++receive;
+      continue;
+    }
+
+    int isMatched = 0;
+    MPI_Message message;
+    MPI_Status status;
+    MPI_Improbe(MPI_ANY_SOURCE, transfer.messageTag, graphCommunicator,
+                &isMatched, &message, &status);
+    if (!isMatched) {
+      unmatched.push_back(transfer.messageTag);
+      ++receive;
+      continue;
+    }
+
+    if (transfer.hasVaryingSize) {
+      receiveHeader(transfer, receive->completion, &message);
+    } else {
+      MPI_Request request;
+      MPI_Imrecv(transfer.buffer, transfer.count, transfer.datatype, &message,
+                 &request);
+      requests.push_back(request);
+      completions.push_back(receive->completion);
+    }
+    receive = batchedReceives.erase(receive);
+    numMatched++;
+  }
+  return numMatched;
+}
+
+void ProgressEngine::enableRma() {
+  lock_guard<mutex> lock(requestMutex);
+  // Connections are made by two ranks alone, so the window has to exist
+  // before and grows as in ports attach to it.
+  MPI_Comm_dup(graphCommunicator, &windowCommunicator);
+  MPI_Comm_rank(windowCommunicator, &windowRank);
+  MPI_Win_create_dynamic(MPI_INFO_NULL, windowCommunicator, &window);
+  MPI_Win_lock_all(MPI_MODE_NOCHECK, window);
+  int *model = nullptr;
+  int hasModel = 0;
+  MPI_Win_get_attr(window, MPI_WIN_MODEL, &model, &hasModel);
+  isWindowUnified = hasModel && *model == MPI_WIN_UNIFIED;
+}
+
+void ProgressEngine::exposeRing(mpi::rank peer, mpi::tag messageTag,
+                                void *slots, size_t size, size_t first,
+                                size_t numSlots, RequestHandler *handler) {
+  std::unique_ptr<ExposedRing> exposed(new ExposedRing);
+  exposed->slots = slots;
+  exposed->tail = 0;
+  exposed->numSeen = 0;
+  exposed->peer = peer;
+  exposed->handler = handler;
+  exposed->ring.first = first;
+  exposed->ring.numSlots = numSlots;
+
+  lock_guard<mutex> lock(requestMutex);
+  MPI_Win_attach(window, slots, static_cast<MPI_Aint>(size));
+  MPI_Win_attach(window, &exposed->tail, sizeof(exposed->tail));
+  MPI_Get_address(slots, &exposed->ring.slots);
+  MPI_Get_address(&exposed->tail, &exposed->ring.tail);
+
+  MPI_Request request;
+  MPI_Isend(&exposed->ring, sizeof(Ring), MPI_BYTE, peer, messageTag,
+            windowCommunicator, &request);
+  requests.push_back(request);
+  completions.push_back({exposed.get(), 0, RequestKind::OTHER, peer});
+  exposedRings.push_back(std::move(exposed));
+}
+
+void ProgressEngine::withdrawRing(RequestHandler *handler) {
+  vector<Completion> completed;
+  std::unique_ptr<ExposedRing> exposed;
+  {
+    lock_guard<mutex> lock(requestMutex);
+    auto ring = std::find_if(exposedRings.begin(), exposedRings.end(),
+                             [handler](const unique_ptr<ExposedRing> &other) {
+                               return other->handler == handler;
+                             });
+    if (ring == exposedRings.end())
+      return;
+
+    pollRing(**ring, completed);
+    MPI_Win_detach(window, (*ring)->slots);
+    MPI_Win_detach(window, &(*ring)->tail);
+    exposed = std::move(*ring);
+    exposedRings.erase(ring);
+  }
+
+  // The location may not have been sent yet.
+  cancel(exposed.get());
+  dispatch(completed);
+}
+
+void ProgressEngine::locateRing(mpi::rank peer, mpi::tag messageTag,
+                                Ring *ring, RequestHandler *handler,
+                                size_t slot) {
+  lock_guard<mutex> lock(requestMutex);
+  MPI_Request request;
+  MPI_Irecv(ring, sizeof(Ring), MPI_BYTE, peer, messageTag,
+            windowCommunicator, &request);
+  requests.push_back(request);
+  completions.push_back({handler, slot, RequestKind::OTHER, peer});
+}
+
+void ProgressEngine::put(const mpi::Transfer &transfer, MPI_Aint address) {
+  lock_guard<mutex> lock(requestMutex);
+  MPI_Put(transfer.buffer, transfer.count, transfer.datatype, transfer.peer,
+          address, transfer.count, transfer.datatype, window);
+}
+
+void ProgressEngine::countPuts(mpi::rank peer, const Ring &ring,
+                               unsigned long long numTokens) {
+  lock_guard<mutex> lock(requestMutex);
+  // Puts are not ordered, so the tokens have to be in place before they
+  // are counted.
+  MPI_Win_flush(peer, window);
+  MPI_Accumulate(&numTokens, 1, MPI_UNSIGNED_LONG_LONG, peer, ring.tail, 1,
+                 MPI_UNSIGNED_LONG_LONG, MPI_SUM, window);
+  MPI_Win_flush(peer, window);
+  numSent += numTokens;
+}
+
+size_t ProgressEngine::pollRings(vector<Completion> &completed) {
+  size_t numArrived = 0;
+  for (auto &exposed : exposedRings)
+    numArrived += pollRing(*exposed, completed);
+  return numArrived;
+}
+
+size_t ProgressEngine::pollRing(ExposedRing &exposed,
+                                vector<Completion> &completed) {
+  // In the unified memory model, the window is the memory of the rank and
+  // a synchronized load sees the accumulates of the source. Otherwise the
+  // tail has to be read through the window.
+  unsigned long long tail = 0;
+  MPI_Win_sync(window);
+  if (isWindowUnified) {
+    tail = __atomic_load_n(&exposed.tail, __ATOMIC_ACQUIRE);
+  } else {
+    unsigned long long unused = 0;
+    MPI_Fetch_and_op(&unused, &tail, MPI_UNSIGNED_LONG_LONG, windowRank,
+                     exposed.ring.tail, MPI_NO_OP, window);
+    MPI_Win_flush(windowRank, window);
+    MPI_Win_sync(window);
+  }
+  if (tail == exposed.numSeen)
+    return 0;
+
+  auto numArrived = tail - exposed.numSeen;
+  for (; exposed.numSeen < tail; exposed.numSeen++)
+    completed.push_back(
+        {exposed.handler, 0, RequestKind::RECEIVE, exposed.peer});
+  return numArrived;
+}
+
+CreditAccount *ProgressEngine::subscribeCredits(mpi::rank peer,
+                                                mpi::tag messageTag,
+                                                const AbstractOutPort *port) {
+  lock_guard<mutex> lock(accountMutex);
+  auto &account = creditAccounts[make_pair(peer, messageTag)];
+  if (!account)
+    account.reset(new CreditAccount(this, peer, messageTag));
+  account->subscribe(port);
+  return account.get();
+}
+
+void ProgressEngine::unsubscribeCredits(CreditAccount *account,
+                                        const AbstractOutPort *port) {
+  lock_guard<mutex> lock(accountMutex);
+  if (account->unsubscribe(port))
+    return;
+
+  // Credits still on their way are granted anew on the next connection.
+  cancel(account);
+  for (auto entry = creditAccounts.begin(); entry != creditAccounts.end();
+       ++entry) {
+    if (entry->second.get() == account) {
+      creditAccounts.erase(entry);
+      return;
+    }
+  }
+}
+
+void ProgressEngine::grantCredits(mpi::rank peer, mpi::tag messageTag,
+                                  unsigned long long count) {
+  size_t slot;
+  auto buffer = grantBuffers.acquire(count, slot);
+  auto transfer = mpi::makeSend(peer, messageTag, *buffer);
+  transfer.isControl = true;
+  submit(transfer, &grantBuffers, slot);
+}
+
+unsigned long long *
+ProgressEngine::GrantBuffers::acquire(unsigned long long count, size_t &slot) {
+  lock_guard<mutex> lock(bufferMutex);
+  if (freeSlots.empty()) {
+    freeSlots.push_back(buffers.size());
+    buffers.emplace_back(new unsigned long long);
+  }
+  slot = freeSlots.back();
+  freeSlots.pop_back();
+  *buffers[slot] = count;
+  return buffers[slot].get();
+}
+
+void ProgressEngine::GrantBuffers::onRequestCompleted(size_t slot) {
+  lock_guard<mutex> lock(bufferMutex);
+  freeSlots.push_back(slot);
+}
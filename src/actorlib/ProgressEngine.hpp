@@ -0,0 +1,554 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Central MPI progress engine of an ActorGraph. All requests of remote ports
+ * are kept in one array and completed with MPI_Testsome, either from the
+ * scheduler loop or from a dedicated progress thread, or with MPI_Waitsome
+ * when the executor is idle. All MPI calls issued on behalf of ports are
+ * serialized by the engine. Messages of varying size start with a header
+ * that holds their element count. Small ones follow it in the same message,
+ * so that their receive can be posted ahead with room for the header and
+ * a few kilobytes of data. Larger ones follow on a communicator of their own,
+ * once the receiver has sized its buffer. Sends are eager, the credit
+ * accounts of the engine bound how many tokens may be in flight.
+ * Connections with the RMA transport put their tokens straight into the
+ * channel of the receiver, which is attached to a dynamic window that all
+ * ranks create together once RMA is enabled. Messages between ranks on the
+ * same node are packed into mailboxes in shared memory instead.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "utils/mpi_helper.hpp"
+
+#pragma once
+
+class AbstractOutPort;
+class CreditAccount;
+
+class RequestHandler {
+public:
+  // Invoked by the ProgressEngine once the request submitted for slot has
+  // completed. May run on any thread.
+  virtual void onRequestCompleted(size_t slot) = 0;
+
+  // Invoked instead for receives, with the rank the message came from.
+  virtual void onReceiveCompleted(size_t slot, mpi::rank) {
+    onRequestCompleted(slot);
+  }
+
+protected:
+  ~RequestHandler() = default;
+};
+
+class ProgressEngine {
+public:
+  ProgressEngine();
+
+  ~ProgressEngine();
+
+  ProgressEngine(ProgressEngine &other) = delete;
+
+  ProgressEngine &operator=(ProgressEngine &other) = delete;
+
+  // A duplicate of MPI_COMM_WORLD private to the graph of the engine, so
+  // that neither its messages nor its collectives can match traffic of the
+  // application. Ranks are those of MPI_COMM_WORLD.
+  MPI_Comm communicator() const { return graphCommunicator; }
+
+  // Posts the transfer and tracks it until it completes.
+  void submit(const mpi::Transfer &transfer, RequestHandler *handler,
+              size_t slot);
+
+  // A request set up once with MPI_Send_init or MPI_Recv_init and started
+  // for every message that uses the same buffer and count.
+  struct PersistentRequest {
+    MPI_Request request = MPI_REQUEST_NULL;
+    void *buffer = nullptr;
+    int count = 0;
+  };
+
+  // Like submit, but starts transfer through request, which is set up anew
+  // only if its buffer or count changed. While messages are aggregated,
+  // the transfer is submitted as usual.
+  void submitPersistent(const mpi::Transfer &transfer,
+                        PersistentRequest &request, RequestHandler *handler,
+                        size_t slot);
+
+  // Frees a persistent request that is not active anymore, e.g. once its
+  // handler was cancelled.
+  void release(PersistentRequest &request);
+
+  // Calls post under the engine lock and tracks the MPI_Request it returns.
+  // Such requests are not counted as messages.
+  template <class Post>
+  void submitRequest(Post &&post, RequestHandler *handler, size_t slot) {
+    std::lock_guard<std::mutex> lock(requestMutex);
+    requests.push_back(post());
+    completions.push_back({handler, slot, RequestKind::OTHER, MPI_ANY_SOURCE});
+  }
+
+  // Tests all outstanding requests once and runs the handlers of the
+  // completed ones. Returns immediately if another thread is already
+  // progressing. Returns the number of completed requests.
+  size_t progress();
+
+  // Blocks in MPI_Waitsome until at least one outstanding request has
+  // completed. Holds the engine lock while blocked, so it may only be
+  // called while no other thread can submit. A message written to a
+  // mailbox of this rank meanwhile rings its doorbell. Batched receives,
+  // receives from any source that may come from another node, sends that
+  // wait for room, rings and rounds cannot be waited for, so while there
+  // are any it polls instead, without holding the lock between polls.
+  size_t waitForCompletion();
+
+  // Cancels all outstanding requests of handler. Requests that completed
+  // before they could be cancelled are dispatched as usual.
+  void cancel(RequestHandler *handler);
+
+  size_t outstanding() const;
+
+  // Coalesces all messages of ports bound for the same rank into batches.
+  // A batch is sent as one message once it holds maxBytes, once its oldest
+  // message is maxDelay old, or on flush(). Has to be enabled on all ranks
+  // before the first transfer. Control transfers are never batched.
+  void enableAggregation(size_t maxBytes, std::chrono::microseconds maxDelay);
+
+  // Sends all batches right away.
+  void flush();
+
+  // Collective. Exchanges the batches with the ranks in sources and
+  // destinations in rounds of neighbourhood collectives over a distributed
+  // graph of these ranks, weighted by their number of connections. Ranks
+  // on the same node are left out while they share memory, and batches are
+  // sent as usual if no rank is left with neighbours. Has to be called with
+  // aggregation enabled, before the first transfer.
+  void exchangeWithNeighbours(const std::map<mpi::rank, int> &sources,
+                              const std::map<mpi::rank, int> &destinations);
+
+  // Collective. Runs empty rounds until every rank has run as many. Has to
+  // be called once all messages have been received.
+  void finishExchange();
+
+  // Passes the messages between ranks on the same node through a mailbox
+  // of mailboxBytes in shared memory, one per pair of ranks, which is
+  // polled by the receiver. Has to be called by all ranks before the first
+  // transfer.
+  void enableSharedMemory(size_t mailboxBytes);
+
+  // Collective. Creates the dynamic window that the rings of in ports are
+  // attached to. Has to be called by all ranks before the first transfer.
+  void enableRma();
+
+  bool hasWindow() const { return window != MPI_WIN_NULL; }
+
+  // Whether the messages to and from peer go through shared memory.
+  bool sharesMemoryWith(mpi::rank peer) const {
+    return isSharing && nodeRanks[peer] >= 0;
+  }
+
+  // Returns the account of the credits that the port with messageTag on
+  // peer grants to this rank, shared by all ports that subscribe to it.
+  CreditAccount *subscribeCredits(mpi::rank peer, mpi::tag messageTag,
+                                  const AbstractOutPort *port);
+
+  void unsubscribeCredits(CreditAccount *account,
+                          const AbstractOutPort *port);
+
+  // Grants peer count more credits for the port with messageTag.
+  void grantCredits(mpi::rank peer, mpi::tag messageTag,
+                    unsigned long long count);
+
+  // Where the slots of an in port that receives through one-sided puts,
+  // and the counter of the tokens put into them, lie in the window of its
+  // rank.
+  struct Ring {
+    MPI_Aint slots = 0;
+    MPI_Aint tail = 0;
+    // The slot the first token goes to, and the number of slots, a power
+    // of two.
+    unsigned long long first = 0;
+    unsigned long long numSlots = 0;
+  };
+
+  // Attaches size bytes of slots to the window and sends their location to
+  // peer. Every token that peer puts completes a receive of handler.
+  void exposeRing(mpi::rank peer, mpi::tag messageTag, void *slots,
+                  size_t size, size_t first, size_t numSlots,
+                  RequestHandler *handler);
+
+  // Detaches the slots of handler. Tokens that arrived in them are still
+  // delivered.
+  void withdrawRing(RequestHandler *handler);
+
+  // Receives the location of the slots of the in port with messageTag on
+  // peer into ring. The request of handler for slot completes with it.
+  void locateRing(mpi::rank peer, mpi::tag messageTag, Ring *ring,
+                  RequestHandler *handler, size_t slot);
+
+  // Puts the token of transfer at address. The receiver only takes it once
+  // it has been counted, and its buffer may only be reused after that.
+  void put(const mpi::Transfer &transfer, MPI_Aint address);
+
+  // Waits for the tokens put to peer and adds numTokens to the tail of
+  // ring. Returns once the tail has been updated.
+  void countPuts(mpi::rank peer, const Ring &ring,
+                 unsigned long long numTokens);
+
+  // Message counters for termination detection. A message is counted as
+  // received only after its handler has run.
+  unsigned long long messagesSent() const { return numSent.load(); }
+  unsigned long long messagesReceived() const { return numReceived.load(); }
+  size_t outstandingSends() const { return numOutstandingSends.load(); }
+
+private:
+  // A BATCH request completes the sends of all messages in the batch. A
+  // HEADER request receives the header of a message of varying size, a
+  // PAYLOAD request the data that follows a header on its own.
+  enum class RequestKind {
+    SEND,
+    RECEIVE,
+    OTHER,
+    BATCH,
+    HEADER,
+    PAYLOAD,
+    BOUNDED
+  };
+
+  struct Completion {
+    RequestHandler *handler;
+    size_t slot;
+    RequestKind kind;
+    mpi::rank source;
+  };
+
+  // Keeps the values of credit grants until they have been sent.
+  class GrantBuffers : public RequestHandler {
+  public:
+    unsigned long long *acquire(unsigned long long count, size_t &slot);
+
+    void onRequestCompleted(size_t slot) final;
+
+  private:
+    std::mutex bufferMutex;
+    std::vector<std::unique_ptr<unsigned long long>> buffers;
+    std::vector<size_t> freeSlots;
+  };
+
+  // A receive that waits for a batched or shared message.
+  struct PendingReceive {
+    mpi::Transfer transfer;
+    Completion completion;
+  };
+
+  // A receive of varying size. Its message goes into buffer first, which
+  // holds its header and, if it is small, its data. Bounded receives go
+  // into their transfer's buffer and leave buffer empty.
+  struct SizedReceive {
+    mpi::Transfer transfer;
+    Completion completion;
+    std::vector<char> buffer;
+    bool hasArrived;
+  };
+
+  // Messages bound for one rank, each packed behind its MessageHeader.
+  struct Batch {
+    std::vector<char> data;
+    std::vector<Completion> messages;
+    std::chrono::steady_clock::time_point since;
+  };
+
+  // One exchange of batches with all neighbours. The sizes go first, so
+  // that the batches can be received in one MPI_Ineighbor_alltoallv.
+  struct Round {
+    std::vector<int> sendSizes;
+    std::vector<int> sendOffsets;
+    std::vector<int> receiveSizes;
+    std::vector<int> receiveOffsets;
+    std::vector<char> sendData;
+    std::vector<char> receiveData;
+    std::vector<Completion> messages;
+    MPI_Request request = MPI_REQUEST_NULL;
+    bool hasSizes = false;
+    std::chrono::steady_clock::time_point since;
+  };
+
+  struct MessageHeader {
+    mpi::tag messageTag;
+    int count;
+    int size;
+  };
+
+  // Messages from one rank to another on the same node. It lies in the
+  // segment of the receiver and is followed by its data. Positions grow
+  // monotonically and are only wrapped on access.
+  struct Mailbox {
+    alignas(64) std::atomic<unsigned long long> head;
+    alignas(64) std::atomic<unsigned long long> tail;
+  };
+
+  // Lies at the start of the segment of a rank, which raises it before it
+  // blocks. The first sender on the node that sees it lowers it again and
+  // sends the rank an empty message, which ends the wait.
+  struct Doorbell {
+    alignas(64) std::atomic<int> isRaised;
+  };
+
+  // A send waiting for room in the mailbox of its peer.
+  struct SharedSend {
+    mpi::Transfer transfer;
+    Completion completion;
+  };
+
+  // A batched or shared message that arrived before a receive for it was
+  // submitted.
+  struct Arrival {
+    mpi::rank source;
+    MessageHeader header;
+    std::vector<char> data;
+  };
+
+  // The slots of a local in port, sent to its source from ring.
+  struct ExposedRing : RequestHandler {
+    void onRequestCompleted(size_t) final {}
+
+    Ring ring;
+    void *slots;
+    // Incremented by the puts of the source.
+    unsigned long long tail;
+    unsigned long long numSeen;
+    mpi::rank peer;
+    RequestHandler *handler;
+  };
+
+  size_t complete(int numCompleted, std::vector<Completion> &completed);
+
+  MPI_Comm communicatorOf(const mpi::Transfer &transfer) const;
+
+  // Handles batches, mailboxes and rings and tests the requests once.
+  size_t poll(std::vector<Completion> &completed);
+
+  // Waits in MPI_Waitsome, or for the doorbell of this rank while it
+  // shares memory.
+  size_t block(std::vector<Completion> &completed);
+
+  size_t testRequests(std::vector<Completion> &completed);
+
+  void remove(size_t index);
+
+  // Returns a free slot of sentBatches.
+  size_t acquireBatchSlot();
+
+  // Returns a free slot of sizedReceives.
+  size_t acquireSizedSlot();
+
+  // Cuts the buffer of a bounded receive to the count that arrived.
+  void completeBounded(SizedReceive &receive, const MPI_Status &status);
+
+  // Sends the header of a message of varying size, and its data along if
+  // that is small. Returns whether it did so, in which case the send is
+  // complete once the header is.
+  bool sendHeader(const mpi::Transfer &transfer, const Completion &completion);
+
+  // Posts the receive of the header of a message of varying size, or takes
+  // the message already matched by MPI_Improbe.
+  void receiveHeader(const mpi::Transfer &transfer,
+                     const Completion &completion,
+                     MPI_Message *message = nullptr);
+
+  // Reads the headers that have arrived for messageTag, in the order their
+  // receives were posted, so that the payloads of one source are received
+  // in the order they were sent. Completes the receives of small messages
+  // and posts those of the payloads of large ones, or receives them right
+  // away if isCancelling.
+  void readHeaders(mpi::tag messageTag, std::vector<Completion> &completed,
+                   bool isCancelling = false);
+
+  void pack(const mpi::Transfer &transfer, const Completion &completion);
+
+  // Upper bound of the size of the data of transfer once packed.
+  int packedSize(const mpi::Transfer &transfer) const;
+
+  // Packs the data of transfer into size bytes at data. Returns the
+  // number of bytes used.
+  int packData(const mpi::Transfer &transfer, char *data, int size) const;
+
+  // Unpacks the data of the message with header at data into buffer.
+  void unpackData(const MessageHeader &header, const char *data, void *buffer,
+                  MPI_Datatype datatype) const;
+
+  // Sends all batches, or only those whose oldest message is overdue.
+  void sendBatches(bool onlyExpired);
+
+  void sendBatch(mpi::rank peer, Batch &batch);
+
+  // Receives the batches that have arrived and unpacks their messages.
+  size_t receiveBatches(std::vector<Completion> &completed);
+
+  // Unpacks the messages in size bytes of batches at data.
+  void unpack(mpi::rank source, const char *data, size_t size,
+              std::vector<Completion> &completed);
+
+  // Whether the batches for peer go through rounds.
+  bool isNeighbour(mpi::rank peer) const;
+
+  // Whether the next round should start, which it does once the previous
+  // one is maxDelay old, a batch is full, or on a flush a batch is waiting.
+  bool isRoundDue(bool isFlushing) const;
+
+  // Moves the batches of all neighbours into a round and starts it.
+  void startRound();
+
+  // Advances the running round. Completes its sends and unpacks the
+  // batches it received once it is done.
+  size_t progressRound(std::vector<Completion> &completed);
+
+  // Hands arrivals to receives submitted since they came in.
+  size_t matchArrivals(std::vector<Completion> &completed);
+
+  // Unpacks a batched message into the first receive matching it.
+  bool deliver(mpi::rank source, const MessageHeader &header, const char *data,
+               std::vector<Completion> &completed);
+
+  // Completes a receive for every token put into a ring since the last
+  // call.
+  size_t pollRings(std::vector<Completion> &completed);
+
+  size_t pollRing(ExposedRing &exposed, std::vector<Completion> &completed);
+
+  // Submits a transfer that goes through a mailbox. Sends that fit are
+  // completed right away.
+  void submitShared(const mpi::Transfer &transfer, RequestHandler *handler,
+                    size_t slot);
+
+  // Whether transfer goes through a mailbox. Receives from any source
+  // may be matched by a mailbox as well.
+  bool isShared(const mpi::Transfer &transfer) const;
+
+  // Writes the message of transfer into the mailbox of its peer. Returns
+  // false if it does not fit yet.
+  bool putShared(const mpi::Transfer &transfer, const Completion &completion);
+
+  // Writes the sends that waited for room, in the order they were
+  // submitted.
+  void sendShared();
+
+  // Takes the messages out of all mailboxes of this rank.
+  size_t receiveShared(std::vector<Completion> &completed);
+
+  // Matches MPI messages of other nodes to receives from any source, which
+  // wait for mailboxes as well.
+  size_t matchRemote();
+
+  // Sends an empty message to peer if its doorbell is raised.
+  void ring(mpi::rank peer);
+
+  // Polling is needed while batched receives, receives from any source
+  // that may be matched by other nodes, shared sends or rings are waiting.
+  bool isPolling() const;
+
+  void dispatch(const std::vector<Completion> &completed);
+
+  mutable std::mutex requestMutex;
+  std::vector<MPI_Request> requests;
+  std::vector<Completion> completions;
+  // Sized receives by slot, and the slots by tag in the order they were
+  // posted.
+  std::vector<SizedReceive> sizedReceives;
+  std::vector<size_t> freeSizedSlots;
+  std::map<mpi::tag, std::deque<size_t>> headerOrder;
+  MPI_Comm payloadCommunicator;
+
+  std::vector<int> completedIndices;
+  std::vector<MPI_Status> completedStatuses;
+  std::vector<mpi::tag> arrivedTags;
+
+  MPI_Comm graphCommunicator;
+  MPI_Comm controlCommunicator;
+  GrantBuffers grantBuffers;
+
+  bool isAggregating;
+  size_t maxBatchBytes;
+  std::chrono::microseconds maxBatchDelay;
+  MPI_Comm batchCommunicator;
+  std::map<mpi::rank, Batch> batches;
+  size_t numBatchedMessages;
+  // Batches are kept until their send has completed.
+  std::vector<Batch> sentBatches;
+  std::vector<size_t> freeBatchSlots;
+  // Receives are matched against batched messages in submission order.
+  std::vector<PendingReceive> batchedReceives;
+  std::deque<Arrival> arrivals;
+
+  bool isExchanging;
+  MPI_Comm neighbourCommunicator;
+  // Neighbours in the order of the blocks of the collectives.
+  std::vector<mpi::rank> sourceRanks;
+  std::vector<mpi::rank> destinationRanks;
+  Round round;
+  unsigned long long numRounds;
+
+  bool isSharing;
+  size_t mailboxBytes;
+  MPI_Comm nodeCommunicator;
+  MPI_Win sharedWindow;
+  // Messages too large for a mailbox are sent on a communicator of their
+  // own, only their header goes through the mailbox.
+  MPI_Comm sharedCommunicator;
+  // The rank on the node of every rank, -1 for ranks on other nodes.
+  std::vector<int> nodeRanks;
+  std::vector<mpi::rank> worldRanks;
+  bool hasRemoteRanks;
+  // Mailboxes from and to the other ranks, by their rank on the node.
+  std::vector<Mailbox *> inbox;
+  std::vector<Mailbox *> outbox;
+  std::map<mpi::rank, std::deque<SharedSend>> sharedBacklog;
+  size_t numBackloggedSends;
+  // Sends that completed when they were written to a mailbox.
+  std::vector<Completion> sharedCompletions;
+  Doorbell *doorbell;
+  std::vector<Doorbell *> doorbells;
+  MPI_Comm doorbellCommunicator;
+  MPI_Request doorbellRequest;
+
+  MPI_Comm windowCommunicator;
+  MPI_Win window;
+  mpi::rank windowRank;
+  bool isWindowUnified;
+  std::vector<std::unique_ptr<ExposedRing>> exposedRings;
+
+  std::mutex accountMutex;
+  std::map<std::pair<mpi::rank, mpi::tag>, std::unique_ptr<CreditAccount>>
+      creditAccounts;
+
+  std::atomic<unsigned long long> numSent{0};
+  std::atomic<unsigned long long> numReceived{0};
+  std::atomic<size_t> numOutstandingSends{0};
+};
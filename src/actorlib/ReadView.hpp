@@ -0,0 +1,78 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Move-only handle to a token that is read in place.
+ */
+
+#include <utility>
+
+#pragma once
+
+// Refers to the first token of an in port while it stays in its channel
+// slot, which saves a copy for large tokens. The slot is handed back to the
+// channel, and the source may refill it, once the view is destroyed or
+// released. Vector buffers then go back to the buffer pool. Only one view
+// of a port may be held at a time, and the port cannot be read from
+// meanwhile. The token may be moved out of the view.
+template <typename T, class Port> class ReadView {
+
+public:
+  ReadView(T *element, Port *port) : element(element), port(port) {}
+
+  ReadView(ReadView &&other) noexcept
+      : element(other.element), port(other.port) {
+    other.port = nullptr;
+  }
+
+  ReadView &operator=(ReadView &&other) noexcept {
+    if (this != &other) {
+      release();
+      element = other.element;
+      port = other.port;
+      other.port = nullptr;
+    }
+    return *this;
+  }
+
+  ReadView(ReadView const &) = delete;
+  ReadView &operator=(ReadView const &) = delete;
+
+  ~ReadView() { release(); }
+
+  T &operator*() const { return *element; }
+
+  T *operator->() const { return element; }
+
+  T *get() const { return element; }
+
+  void release() {
+    if (!port)
+      return;
+    auto releasing = port;
+    port = nullptr;
+    releasing->releaseView();
+  }
+
+private:
+  T *element;
+  Port *port;
+};
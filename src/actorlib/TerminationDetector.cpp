@@ -0,0 +1,91 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include "TerminationDetector.hpp"
+
+using namespace std;
+
+namespace {
+constexpr int SENT = 0;
+constexpr int RECEIVED = 1;
+} // namespace
+
+TerminationDetector::TerminationDetector(ProgressEngine *progressEngine,
+                                         function<bool()> isLocallyPassive)
+    : progressEngine(progressEngine),
+      isLocallyPassive(std::move(isLocallyPassive)), isWaveRunning(false),
+      hasPreviousWave(false), localCounts{0, 0}, globalCounts{0, 0},
+      previousCounts{0, 0}, terminated(false) {
+  // Waves must not match the collectives of the graph.
+  MPI_Comm_dup(progressEngine->communicator(), &communicator);
+}
+
+TerminationDetector::~TerminationDetector() { MPI_Comm_free(&communicator); }
+
+void TerminationDetector::poll() {
+  if (terminated.load())
+    return;
+
+  unique_lock<mutex> lock(waveMutex, std::try_to_lock);
+  if (!lock.owns_lock() || isWaveRunning || terminated.load())
+    return;
+
+  // Counters first: a handler queues its actor before it is counted.
+  localCounts[RECEIVED] = progressEngine->messagesReceived();
+  localCounts[SENT] = progressEngine->messagesSent();
+  if (!isLocallyPassive())
+    return;
+
+  isWaveRunning = true;
+  progressEngine->submitRequest(
+      [this]() {
+        MPI_Request request;
+        MPI_Iallreduce(localCounts, globalCounts, 2, MPI_UNSIGNED_LONG_LONG,
+                       MPI_SUM, communicator, &request);
+        return request;
+      },
+      this, 0);
+}
+
+void TerminationDetector::onRequestCompleted(size_t) {
+  {
+    lock_guard<mutex> lock(waveMutex);
+    isWaveRunning = false;
+
+    // No message was sent or received between the two waves, and none is
+    // in transit.
+    if (hasPreviousWave && globalCounts[SENT] == globalCounts[RECEIVED] &&
+        globalCounts[SENT] == previousCounts[SENT] &&
+        globalCounts[RECEIVED] == previousCounts[RECEIVED]) {
+      terminated.store(true);
+      return;
+    }
+
+    previousCounts[SENT] = globalCounts[SENT];
+    previousCounts[RECEIVED] = globalCounts[RECEIVED];
+    hasPreviousWave = true;
+  }
+
+  poll();
+}
@@ -0,0 +1,72 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Distributed termination detection after Mattern's four-counter method.
+ * A rank joins a wave, a non-blocking sum over the sent and received message
+ * counts of all ranks, only while it is locally passive. The graph has
+ * terminated once two consecutive waves report the same, balanced counts.
+ */
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+#include "ProgressEngine.hpp"
+#include "utils/mpi_helper.hpp"
+
+#pragma once
+
+class TerminationDetector : public RequestHandler {
+public:
+  // isLocallyPassive must only hold while no local actor is queued or
+  // running and no send is outstanding, so that only an incoming message
+  // can make the rank active again.
+  TerminationDetector(ProgressEngine *progressEngine,
+                      std::function<bool()> isLocallyPassive);
+
+  ~TerminationDetector();
+
+  TerminationDetector(TerminationDetector &other) = delete;
+
+  TerminationDetector &operator=(TerminationDetector &other) = delete;
+
+  // Starts the next wave if this rank is passive and no wave is running.
+  void poll();
+
+  bool hasTerminated() const { return terminated.load(); }
+
+  void onRequestCompleted(size_t slot) final;
+
+private:
+  ProgressEngine *progressEngine;
+  std::function<bool()> isLocallyPassive;
+  MPI_Comm communicator;
+
+  std::mutex waveMutex;
+  bool isWaveRunning;
+  bool hasPreviousWave;
+  unsigned long long localCounts[2];
+  unsigned long long globalCounts[2];
+  unsigned long long previousCounts[2];
+
+  std::atomic<bool> terminated;
+};
@@ -0,0 +1,354 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+#include "WorkStealingExecutor.hpp"
+
+#include "Actor.hpp"
+#include "ProgressEngine.hpp"
+
+using namespace std;
+
+namespace {
+// Index of the worker the calling thread belongs to, if any.
+thread_local long currentWorker = -1;
+} // namespace
+
+WorkStealingExecutor::WorkStealingExecutor(
+    const vector<Actor *> &actors, const ExecutionConfiguration &configuration,
+    ProgressEngine *progressEngine)
+    : actors(actors), busyActors(0), isStopped(false),
+      progressEngine(progressEngine),
+      useProgressThread(configuration.progressMode ==
+                        ProgressMode::PROGRESS_THREAD),
+      idlePolicy(configuration.idlePolicy),
+      emptyPassesBeforeIdle(configuration.emptyPassesBeforeIdle),
+      batchSize(std::max(configuration.batchSize, 1u)),
+      parkedWorkers(0), isWaitingForCompletion(false),
+      terminationDetector(progressEngine,
+                          [this]() { return isLocallyPassive(); }) {
+  auto numberOfWorkers = configuration.workers();
+  if (numberOfWorkers == 0)
+    throw std::runtime_error("Executor needs at least one worker.");
+
+  for (unsigned int i = 0; i < numberOfWorkers; i++)
+    queues.emplace_back(new WorkerQueue());
+
+  // Every actor is evaluated once initially, except those that finished in
+  // an earlier run. Round-robin placement, stealing evens out the rest.
+  size_t next = 0;
+  for (auto actor : actors) {
+    actor->executor = this;
+    if (actor->schedulingState.load() == SchedulingState::FINISHED)
+      continue;
+    actor->schedulingState.store(SchedulingState::QUEUED);
+    queues[next++ % numberOfWorkers]->push(actor);
+    busyActors++;
+  }
+}
+
+WorkStealingExecutor::~WorkStealingExecutor() {
+  for (auto actor : actors)
+    actor->executor = nullptr;
+}
+
+void WorkStealingExecutor::run() {
+  vector<thread> workers;
+  for (size_t i = 1; i < queues.size(); i++)
+    workers.emplace_back(&WorkStealingExecutor::work, this, i);
+
+  thread progressThread;
+  if (useProgressThread)
+    progressThread = thread(&WorkStealingExecutor::driveProgress, this);
+
+  work(0);
+
+  for (auto &worker : workers)
+    worker.join();
+  if (progressThread.joinable())
+    progressThread.join();
+
+  if (error)
+    std::rethrow_exception(error);
+}
+
+void WorkStealingExecutor::notify(Actor *actor) {
+  auto state = actor->schedulingState.load();
+  while (true) {
+    switch (state) {
+    case SchedulingState::WAITING:
+      if (actor->schedulingState.compare_exchange_weak(
+              state, SchedulingState::QUEUED)) {
+        busyActors++;
+        pushLocal(currentWorker >= 0 ? currentWorker : 0, actor);
+        if (parkedWorkers.load() > 0)
+          wakeParkedWorkers(false);
+        return;
+      }
+      break;
+    case SchedulingState::RUNNING:
+      // The worker running it re-queues it after act() returns.
+      if (actor->schedulingState.compare_exchange_weak(
+              state, SchedulingState::RESCHEDULE))
+        return;
+      break;
+    default:
+      return;
+    }
+  }
+}
+
+bool WorkStealingExecutor::isRunning() const {
+  return !isStopped.load(std::memory_order_acquire) &&
+         !terminationDetector.hasTerminated();
+}
+
+bool WorkStealingExecutor::isLocallyPassive() const {
+  return busyActors.load() == 0 && progressEngine->outstandingSends() == 0;
+}
+
+void WorkStealingExecutor::work(size_t worker) {
+  currentWorker = worker;
+  size_t emptyPasses = 0;
+  try {
+    while (isRunning()) {
+      if (!useProgressThread && progressEngine->progress() > 0)
+        emptyPasses = 0;
+
+      Actor *actor = popLocal(worker);
+      if (!actor)
+        actor = steal(worker);
+      if (actor) {
+        emptyPasses = 0;
+        invoke(worker, actor);
+      } else {
+        idle(++emptyPasses);
+      }
+    }
+  } catch (...) {
+    {
+      lock_guard<mutex> lock(errorMutex);
+      if (!error)
+        error = std::current_exception();
+    }
+    // Release the other workers, the graph cannot finish anymore.
+    isStopped.store(true, std::memory_order_release);
+  }
+  wakeParkedWorkers(true);
+  currentWorker = -1;
+}
+
+void WorkStealingExecutor::driveProgress() {
+  size_t emptyPasses = 0;
+  while (isRunning()) {
+    if (progressEngine->progress() > 0) {
+      emptyPasses = 0;
+      continue;
+    }
+    progressEngine->flush();
+    terminationDetector.poll();
+    if (++emptyPasses < emptyPassesBeforeIdle || idlePolicy == IdlePolicy::SPIN)
+      continue;
+
+    // Waiting is only safe while all workers are parked, since no worker
+    // can then submit a request. Only completions run here can wake them.
+    // A worker that was just woken still counts as parked until it runs,
+    // but the actor it was woken for is still queued.
+    if (idlePolicy == IdlePolicy::BLOCK &&
+        parkedWorkers.load() == queues.size() && !hasQueuedActors() &&
+        progressEngine->outstanding() > 0)
+      progressEngine->waitForCompletion();
+    else
+      std::this_thread::yield();
+  }
+  wakeParkedWorkers(true);
+}
+
+void WorkStealingExecutor::idle(size_t emptyPasses) {
+  // Batched messages must not wait for more while nothing else is ready.
+  progressEngine->flush();
+  terminationDetector.poll();
+  if (emptyPasses < emptyPassesBeforeIdle)
+    return;
+
+  switch (idlePolicy) {
+  case IdlePolicy::SPIN:
+    break;
+  case IdlePolicy::YIELD:
+    std::this_thread::yield();
+    break;
+  case IdlePolicy::BLOCK:
+    park();
+    break;
+  }
+}
+
+void WorkStealingExecutor::park() {
+  unique_lock<mutex> lock(idleMutex);
+  // Registering before checking the deques pairs with notify(), which
+  // pushes before checking for parked workers.
+  parkedWorkers++;
+  if (hasQueuedActors() || !isRunning()) {
+    parkedWorkers--;
+    return;
+  }
+
+  // The last worker to park waits for remote completions, unless a
+  // progress thread does that.
+  if (!useProgressThread && !isWaitingForCompletion &&
+      parkedWorkers.load() == queues.size() &&
+      progressEngine->outstanding() > 0) {
+    isWaitingForCompletion = true;
+    lock.unlock();
+    progressEngine->waitForCompletion();
+    lock.lock();
+    isWaitingForCompletion = false;
+    parkedWorkers--;
+    return;
+  }
+
+  idleCondition.wait(lock);
+  parkedWorkers--;
+}
+
+bool WorkStealingExecutor::hasQueuedActors() {
+  for (auto &queue : queues) {
+    lock_guard<mutex> lock(queue->mutex);
+    if (!queue->empty())
+      return true;
+  }
+  return false;
+}
+
+void WorkStealingExecutor::wakeParkedWorkers(bool all) {
+  lock_guard<mutex> lock(idleMutex);
+  if (all)
+    idleCondition.notify_all();
+  else
+    idleCondition.notify_one();
+}
+
+void WorkStealingExecutor::invoke(size_t worker, Actor *actor) {
+  actor->schedulingState.store(SchedulingState::RUNNING);
+
+  if (actor->isReady()) {
+    auto start = chrono::steady_clock::now();
+    bool hasFinished = actor->actBatch(batchSize);
+    actor->busyTime +=
+        chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    if (hasFinished) {
+      actor->schedulingState.store(SchedulingState::FINISHED);
+      busyActors--;
+      return;
+    }
+  }
+
+  reschedule(worker, actor);
+}
+
+void WorkStealingExecutor::reschedule(size_t worker, Actor *actor) {
+  // The rules are evaluated while the actor is still RUNNING, so that no
+  // other worker can invoke it concurrently. An event arriving after the
+  // evaluation turns RUNNING into RESCHEDULE and is not lost.
+  if (actor->isReady()) {
+    actor->schedulingState.store(SchedulingState::QUEUED);
+    pushLocal(worker, actor);
+    return;
+  }
+
+  auto expected = SchedulingState::RUNNING;
+  if (actor->schedulingState.compare_exchange_strong(
+          expected, SchedulingState::WAITING)) {
+    busyActors--;
+  } else {
+    actor->schedulingState.store(SchedulingState::QUEUED);
+    pushLocal(worker, actor);
+  }
+}
+
+Actor *WorkStealingExecutor::popLocal(size_t worker) {
+  // The owner works FIFO so that an actor waiting for a peer in the same
+  // deque cannot starve it.
+  auto &queue = *queues[worker];
+  lock_guard<mutex> lock(queue.mutex);
+  return queue.popFront();
+}
+
+Actor *WorkStealingExecutor::steal(size_t thief) {
+  for (size_t i = 1; i < queues.size(); i++) {
+    auto &victim = *queues[(thief + i) % queues.size()];
+    unique_lock<mutex> lock(victim.mutex, std::try_to_lock);
+    if (!lock.owns_lock())
+      continue;
+    // Thieves take the highest priority, too, but the newest entry.
+    Actor *actor = victim.popBack();
+    if (actor)
+      return actor;
+  }
+  return nullptr;
+}
+
+void WorkStealingExecutor::pushLocal(size_t worker, Actor *actor) {
+  auto &queue = *queues[worker];
+  lock_guard<mutex> lock(queue.mutex);
+  queue.push(actor);
+}
+
+void WorkStealingExecutor::WorkerQueue::push(Actor *actor) {
+  levels[actor->getPriority()].push_back(actor);
+}
+
+Actor *WorkStealingExecutor::WorkerQueue::popFront() {
+  for (auto &level : levels) {
+    if (!level.second.empty()) {
+      Actor *actor = level.second.front();
+      level.second.pop_front();
+      return actor;
+    }
+  }
+  return nullptr;
+}
+
+Actor *WorkStealingExecutor::WorkerQueue::popBack() {
+  for (auto &level : levels) {
+    if (!level.second.empty()) {
+      Actor *actor = level.second.back();
+      level.second.pop_back();
+      return actor;
+    }
+  }
+  return nullptr;
+}
+
+bool WorkStealingExecutor::WorkerQueue::empty() const {
+  for (auto &level : levels) {
+    if (!level.second.empty())
+      return false;
+  }
+  return true;
+}
@@ -0,0 +1,133 @@
+/**
+ * @file
+ * This file is part of actorlib.
+ *
+ * @section LICENSE
+ *
+ * actorlib is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * actorlib is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with actorlib.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *
+ * @section DESCRIPTION
+ *
+ * Readiness-driven executor that runs the local actors of an ActorGraph on a
+ * pool of worker threads. Only actors whose firing rules hold are kept in
+ * the per-worker ready deques; idle workers steal from the opposite end of
+ * their peers' deques. Channel events and completed remote requests put
+ * waiting actors back in a deque. Deques are ordered by actor priority, so
+ * that actors on the critical path run first. Idle workers spin, yield or
+ * block as selected by the IdlePolicy.
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "ExecutionConfiguration.hpp"
+#include "TerminationDetector.hpp"
+
+#pragma once
+
+class Actor;
+class ProgressEngine;
+
+class WorkStealingExecutor {
+public:
+  WorkStealingExecutor(const std::vector<Actor *> &actors,
+                       const ExecutionConfiguration &configuration,
+                       ProgressEngine *progressEngine);
+
+  ~WorkStealingExecutor();
+
+  WorkStealingExecutor(WorkStealingExecutor &other) = delete;
+
+  WorkStealingExecutor &operator=(WorkStealingExecutor &other) = delete;
+
+  // Blocks until the graph has terminated on all ranks, i.e. no actor is
+  // ready anywhere and no message is in transit. An actor that returns true
+  // from act() is retired and will not be invoked again, not even by later
+  // runs. With a single worker, no additional thread is started.
+  void run();
+
+  // Re-evaluates a waiting actor after an event on one of its ports. May be
+  // called from any thread.
+  void notify(Actor *actor);
+
+private:
+  // One FIFO per priority level, highest level first. Levels are never
+  // erased, so that steady-state pushes do not allocate map nodes.
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::map<int, std::deque<Actor *>, std::greater<int>> levels;
+
+    void push(Actor *actor);
+    Actor *popFront();
+    Actor *popBack();
+    bool empty() const;
+  };
+
+  bool isRunning() const;
+
+  bool isLocallyPassive() const;
+
+  void work(size_t worker);
+
+  void driveProgress();
+
+  void idle(size_t emptyPasses);
+
+  void park();
+
+  bool hasQueuedActors();
+
+  void wakeParkedWorkers(bool all);
+
+  void invoke(size_t worker, Actor *actor);
+
+  void reschedule(size_t worker, Actor *actor);
+
+  Actor *popLocal(size_t worker);
+
+  Actor *steal(size_t thief);
+
+  void pushLocal(size_t worker, Actor *actor);
+
+  std::vector<Actor *> actors;
+  std::vector<std::unique_ptr<WorkerQueue>> queues;
+  // Actors that are queued or running.
+  std::atomic<size_t> busyActors;
+  std::atomic<bool> isStopped;
+
+  ProgressEngine *progressEngine;
+  bool useProgressThread;
+  IdlePolicy idlePolicy;
+  size_t emptyPassesBeforeIdle;
+  size_t batchSize;
+
+  std::mutex idleMutex;
+  std::condition_variable idleCondition;
+  std::atomic<size_t> parkedWorkers;
+  bool isWaitingForCompletion;
+
+  std::mutex errorMutex;
+  std::exception_ptr error;
+
+  TerminationDetector terminationDetector;
+};
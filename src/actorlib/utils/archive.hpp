@@ -0,0 +1,151 @@
+//
+// Byte archives used to move actor state and channel contents between ranks.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace archive {
+
+class OutArchive {
+public:
+  template <class T>
+  typename std::enable_if<std::is_trivially_copyable<T>::value,
+                          OutArchive &>::type
+  operator<<(const T &value) {
+    auto bytes = reinterpret_cast<const char *>(&value);
+    buffer.insert(buffer.end(), bytes, bytes + sizeof(T));
+    return *this;
+  }
+
+  template <class T> OutArchive &operator<<(const std::vector<T> &values) {
+    *this << values.size();
+    append(values, std::is_trivially_copyable<T>());
+    return *this;
+  }
+
+  OutArchive &operator<<(const std::string &value) {
+    *this << value.size();
+    buffer.insert(buffer.end(), value.begin(), value.end());
+    return *this;
+  }
+
+  const std::vector<char> &data() const { return buffer; }
+
+private:
+  template <class T>
+  void append(const std::vector<T> &values, std::true_type) {
+    auto bytes = reinterpret_cast<const char *>(values.data());
+    buffer.insert(buffer.end(), bytes, bytes + values.size() * sizeof(T));
+  }
+
+  template <class T>
+  void append(const std::vector<T> &values, std::false_type) {
+    for (auto &value : values)
+      *this << value;
+  }
+
+  std::vector<char> buffer;
+};
+
+class InArchive {
+public:
+  InArchive(const char *data, size_t size)
+      : data(data), size(size), position(0) {}
+
+  template <class T>
+  typename std::enable_if<std::is_trivially_copyable<T>::value,
+                          InArchive &>::type
+  operator>>(T &value) {
+    std::memcpy(&value, take(sizeof(T)), sizeof(T));
+    return *this;
+  }
+
+  template <class T> InArchive &operator>>(std::vector<T> &values) {
+    size_t count;
+    *this >> count;
+    values.resize(count);
+    extract(values, std::is_trivially_copyable<T>());
+    return *this;
+  }
+
+  InArchive &operator>>(std::string &value) {
+    size_t count;
+    *this >> count;
+    value.assign(take(count), count);
+    return *this;
+  }
+
+  bool isExhausted() const { return position == size; }
+
+private:
+  template <class T> void extract(std::vector<T> &values, std::true_type) {
+    auto numBytes = values.size() * sizeof(T);
+    std::memcpy(values.data(), take(numBytes), numBytes);
+  }
+
+  template <class T> void extract(std::vector<T> &values, std::false_type) {
+    for (auto &value : values)
+      *this >> value;
+  }
+
+  const char *take(size_t numBytes) {
+    if (position + numBytes > size)
+      throw std::runtime_error("Archive is shorter than expected.");
+    auto current = data + position;
+    position += numBytes;
+    return current;
+  }
+
+  const char *data;
+  size_t size;
+  size_t position;
+};
+
+template <class T> struct is_archivable : std::is_trivially_copyable<T> {};
+
+template <class T>
+struct is_archivable<std::vector<T>> : is_archivable<T> {};
+
+template <> struct is_archivable<std::vector<bool>> : std::false_type {};
+
+template <> struct is_archivable<std::string> : std::true_type {};
+
+namespace detail {
+
+template <class T>
+void save(OutArchive &out, const T &value, std::true_type) {
+  out << value;
+}
+
+template <class T> void save(OutArchive &, const T &, std::false_type) {
+  throw std::runtime_error("Type is not supported by archives.");
+}
+
+template <class T> void load(InArchive &in, T &value, std::true_type) {
+  in >> value;
+}
+
+template <class T> void load(InArchive &, T &, std::false_type) {
+  throw std::runtime_error("Type is not supported by archives.");
+}
+
+} // namespace detail
+
+// Like the stream operators, but compile for any type and throw for types
+// the archives do not support. Used by generic code such as ports.
+template <class T> void save(OutArchive &out, const T &value) {
+  detail::save(out, value, typename is_archivable<T>::type());
+}
+
+template <class T> void load(InArchive &in, T &value) {
+  detail::load(in, value, typename is_archivable<T>::type());
+}
+
+} // namespace archive
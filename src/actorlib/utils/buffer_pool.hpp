@@ -0,0 +1,118 @@
+//
+// Size-class pool of std::vector buffers for messages of varying length.
+//
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace pool {
+
+// Buffers are grouped by their capacity, rounded up to a power of two. A
+// released buffer serves any later request of its class, so halos of
+// similar size reuse the same allocations. Every thread keeps a few buffers
+// per class for itself and only goes to the shared lists when it runs out
+// or has too many.
+template <class T> class SizeClassPool {
+public:
+  static SizeClassPool &instance() {
+    static SizeClassPool pool;
+    return pool;
+  }
+
+  // Returns a buffer of the given size, with the capacity of its class.
+  std::vector<T> acquire(size_t size) {
+    auto sizeClass = classOf(size);
+    std::vector<T> buffer;
+    auto &cached = localCache().freeLists[sizeClass];
+    if (!cached.empty()) {
+      buffer = std::move(cached.back());
+      cached.pop_back();
+    } else {
+      std::lock_guard<std::mutex> lock(poolMutex);
+      auto &freeBuffers = freeLists[sizeClass];
+      if (!freeBuffers.empty()) {
+        buffer = std::move(freeBuffers.back());
+        freeBuffers.pop_back();
+      }
+    }
+    buffer.reserve(size_t(1) << sizeClass);
+    buffer.resize(size);
+    return buffer;
+  }
+
+  void release(std::vector<T> &&buffer) {
+    if (buffer.capacity() == 0)
+      return;
+    // A buffer only serves requests up to the class below its capacity,
+    // unless the capacity is a power of two.
+    auto sizeClass = classOf(buffer.capacity() + 1) - 1;
+    buffer.clear();
+    auto &cached = localCache().freeLists[sizeClass];
+    if (cached.size() < LOCAL_BUFFERS_PER_CLASS) {
+      cached.push_back(std::move(buffer));
+      return;
+    }
+    releaseShared(sizeClass, std::move(buffer));
+  }
+
+private:
+  static constexpr size_t NUM_CLASSES = 8 * sizeof(size_t);
+  static constexpr size_t MAX_BUFFERS_PER_CLASS = 64;
+  static constexpr size_t LOCAL_BUFFERS_PER_CLASS = 4;
+
+  typedef std::array<std::vector<std::vector<T>>, NUM_CLASSES> FreeLists;
+
+  // Hands its buffers to the shared lists when the thread exits.
+  struct LocalCache {
+    FreeLists freeLists;
+
+    ~LocalCache() {
+      auto &pool = instance();
+      for (size_t sizeClass = 0; sizeClass < NUM_CLASSES; sizeClass++) {
+        for (auto &buffer : freeLists[sizeClass])
+          pool.releaseShared(sizeClass, std::move(buffer));
+      }
+    }
+  };
+
+  SizeClassPool() = default;
+
+  static LocalCache &localCache() {
+    static thread_local LocalCache cache;
+    return cache;
+  }
+
+  void releaseShared(size_t sizeClass, std::vector<T> &&buffer) {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    auto &freeBuffers = freeLists[sizeClass];
+    if (freeBuffers.size() < MAX_BUFFERS_PER_CLASS)
+      freeBuffers.push_back(std::move(buffer));
+  }
+
+  static size_t classOf(size_t size) {
+    size_t sizeClass = 0;
+    while ((size_t(1) << sizeClass) < size)
+      sizeClass++;
+    return sizeClass;
+  }
+
+  std::mutex poolMutex;
+  FreeLists freeLists;
+};
+
+// Message buffers for user code. Ports return the buffers of sent tokens
+// and of released read views to the pool themselves.
+template <class T> std::vector<T> acquire(size_t size) {
+  return SizeClassPool<T>::instance().acquire(size);
+}
+
+template <class T> void release(std::vector<T> &&buffer) {
+  SizeClassPool<T>::instance().release(std::move(buffer));
+}
+
+} // namespace pool
@@ -0,0 +1,295 @@
+//
+// Codecs that shrink the tokens of remote connections before they are sent.
+//
+
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "buffer_pool.hpp"
+#include "mpi_type_traits.h"
+
+namespace codec {
+
+// Sends tokens as they are. The default of all ports.
+struct None {};
+
+// Lossless. Every element is XORed with its predecessor, which zeroes most
+// bytes of smooth or constant data, and the bytes are then grouped by their
+// position within the elements, which puts these zeros next to each other.
+// Runs of zeros are stored as their length. Tokens of less than minBytes
+// are sent as they are, as are tokens that would not shrink.
+template <size_t minimumBytes = 1024> struct XorDelta {
+  static constexpr size_t minBytes = minimumBytes;
+
+  template <class Element>
+  static void encode(const Element *elements, size_t count,
+                     std::vector<char> &out);
+
+  template <class Element>
+  static void decode(const char *data, size_t size, Element *elements,
+                     size_t count);
+};
+
+// Lossy. Rounds the mantissa of every floating point element to keptBits
+// bits, which bounds the relative error by 2^-(keptBits + 1), and encodes
+// the result like XorDelta. NaN and infinity are kept as they are, finite
+// values that would round to infinity are cut off instead.
+template <int keptBits, size_t minimumBytes = 1024> struct Truncated {
+  static constexpr size_t minBytes = minimumBytes;
+
+  template <class Element>
+  static void encode(const Element *elements, size_t count,
+                     std::vector<char> &out);
+
+  template <class Element>
+  static void decode(const char *data, size_t size, Element *elements,
+                     size_t count) {
+    XorDelta<minimumBytes>::decode(data, size, elements, count);
+  }
+};
+
+template <class Codec> struct is_enabled : std::true_type {};
+
+template <> struct is_enabled<None> : std::false_type {};
+
+namespace detail {
+
+// Precedes the data of every encoded token. The fields are copied one by
+// one, so that no padding goes out with them.
+struct Header {
+  unsigned long long count;
+  bool isEncoded;
+
+  static constexpr size_t bytes = sizeof(count) + sizeof(isEncoded);
+
+  void write(char *data) const {
+    memcpy(data, &count, sizeof(count));
+    memcpy(data + sizeof(count), &isEncoded, sizeof(isEncoded));
+  }
+
+  void read(const char *data) {
+    memcpy(&count, data, sizeof(count));
+    memcpy(&isEncoded, data + sizeof(count), sizeof(isEncoded));
+  }
+};
+
+template <class T>
+using element_t = std::remove_const_t<std::remove_pointer_t<decltype(
+    mpi::mpi_type_traits<T>::get_addr(std::declval<T &>()))>>;
+
+template <class T>
+auto elementsOf(T &token, size_t count, std::true_type) {
+  return mpi::mpi_type_traits<T>::resize(token, count);
+}
+
+template <class T>
+auto elementsOf(T &token, size_t count, std::false_type) {
+  if (count != mpi::mpi_type_traits<T>::get_size(token))
+    throw std::runtime_error("Encoded token has the wrong number of "
+                             "elements.");
+  return mpi::mpi_type_traits<T>::get_addr(token);
+}
+
+inline void appendZeros(size_t &run, std::vector<char> &out) {
+  out.push_back(0);
+  out.push_back(static_cast<char>(run - 1));
+  run = 0;
+}
+
+template <class Word> Word cutOff(Word bits, int droppedBits) {
+  if (droppedBits <= 0)
+    return bits;
+  return bits & ~((Word(1) << droppedBits) - 1);
+}
+
+template <class Word> Word rounded(Word bits, int droppedBits) {
+  if (droppedBits <= 0)
+    return bits;
+  return cutOff(bits + (Word(1) << (droppedBits - 1)), droppedBits);
+}
+
+template <class Element>
+Element truncated(Element element, int keptBits) {
+  static_assert(std::numeric_limits<Element>::is_iec559,
+                "Only floating point elements can be truncated.");
+  using Word = std::conditional_t<sizeof(Element) == sizeof(uint32_t),
+                                  uint32_t, uint64_t>;
+  static_assert(sizeof(Element) == sizeof(Word),
+                "Only float and double elements can be truncated.");
+  // A carry would turn the payload of a NaN into another one, or into
+  // infinity.
+  if (!std::isfinite(element))
+    return element;
+
+  Word bits;
+  memcpy(&bits, &element, sizeof(bits));
+  auto droppedBits = std::numeric_limits<Element>::digits - 1 - keptBits;
+  Word roundedBits = rounded(bits, droppedBits);
+  Element result;
+  memcpy(&result, &roundedBits, sizeof(roundedBits));
+  // The carry of the largest values reaches the exponent of infinity.
+  if (std::isinf(result)) {
+    bits = cutOff(bits, droppedBits);
+    memcpy(&result, &bits, sizeof(bits));
+  }
+  return result;
+}
+} // namespace detail
+
+template <size_t minimumBytes>
+template <class Element>
+void XorDelta<minimumBytes>::encode(const Element *elements, size_t count,
+                                    std::vector<char> &out) {
+  static_assert(std::is_trivially_copyable<Element>::value,
+                "Only trivially copyable elements can be encoded.");
+  auto bytes = reinterpret_cast<const unsigned char *>(elements);
+  constexpr size_t width = sizeof(Element);
+  size_t run = 0;
+  for (size_t position = 0; position < width; position++) {
+    unsigned char previous = 0;
+    for (size_t i = 0; i < count; i++) {
+      unsigned char byte = bytes[i * width + position];
+      unsigned char delta = byte ^ previous;
+      previous = byte;
+      if (delta == 0) {
+        if (++run == 256)
+          detail::appendZeros(run, out);
+        continue;
+      }
+      if (run > 0)
+        detail::appendZeros(run, out);
+      out.push_back(static_cast<char>(delta));
+    }
+  }
+  if (run > 0)
+    detail::appendZeros(run, out);
+}
+
+template <size_t minimumBytes>
+template <class Element>
+void XorDelta<minimumBytes>::decode(const char *data, size_t size,
+                                    Element *elements, size_t count) {
+  auto bytes = reinterpret_cast<unsigned char *>(elements);
+  constexpr size_t width = sizeof(Element);
+  size_t total = count * width;
+  size_t written = 0;
+  // Bytes are written plane by plane, each after its predecessor.
+  size_t position = 0;
+  size_t i = 0;
+  unsigned char previous = 0;
+  auto append = [&](unsigned char delta) {
+    previous ^= delta;
+    bytes[i * width + position] = previous;
+    if (++i == count) {
+      i = 0;
+      position++;
+      previous = 0;
+    }
+    written++;
+  };
+  for (size_t offset = 0; offset < size; offset++) {
+    auto delta = static_cast<unsigned char>(data[offset]);
+    size_t run = 1;
+    if (delta == 0) {
+      if (++offset == size)
+        throw std::runtime_error("Encoded token is truncated.");
+      run = static_cast<unsigned char>(data[offset]) + size_t(1);
+    }
+    if (written + run > total)
+      throw std::runtime_error("Encoded token is too long.");
+    while (run-- > 0)
+      append(delta);
+  }
+  if (written != total)
+    throw std::runtime_error("Encoded token is too short.");
+}
+
+template <int keptBits, size_t minimumBytes>
+template <class Element>
+void Truncated<keptBits, minimumBytes>::encode(const Element *elements,
+                                               size_t count,
+                                               std::vector<char> &out) {
+  auto copy = pool::acquire<Element>(count);
+  for (size_t i = 0; i < count; i++)
+    copy[i] = detail::truncated(elements[i], keptBits);
+  XorDelta<minimumBytes>::encode(copy.data(), count, out);
+  pool::release(std::move(copy));
+}
+
+namespace detail {
+template <class Codec, class T>
+void encode(T &, std::vector<char> &, std::false_type) {}
+
+template <class Codec, class T>
+void encode(T &token, std::vector<char> &frame, std::true_type) {
+  using Element = element_t<T>;
+  auto elements = mpi::mpi_type_traits<T>::get_addr(token);
+  auto count = mpi::mpi_type_traits<T>::get_size(token);
+  auto size = count * sizeof(Element);
+
+  Header header{count, size >= Codec::minBytes};
+  frame = pool::acquire<char>(Header::bytes + size);
+  frame.resize(Header::bytes);
+  if (header.isEncoded) {
+    Codec::encode(elements, count, frame);
+    // Incompressible data is not worth decoding.
+    if (frame.size() >= Header::bytes + size) {
+      header.isEncoded = false;
+      frame.resize(Header::bytes);
+    }
+  }
+  if (!header.isEncoded) {
+    auto bytes = reinterpret_cast<const char *>(elements);
+    frame.insert(frame.end(), bytes, bytes + size);
+  }
+  header.write(frame.data());
+}
+
+template <class Codec, class T>
+void decode(const std::vector<char> &, T &, std::false_type) {}
+
+template <class Codec, class T>
+void decode(const std::vector<char> &frame, T &token, std::true_type) {
+  using Element = element_t<T>;
+  Header header;
+  if (frame.size() < Header::bytes)
+    throw std::runtime_error("Encoded token lacks its header.");
+  header.read(frame.data());
+
+  auto elements =
+      elementsOf(token, header.count, mpi::is_dynamically_sized<T>());
+  auto data = frame.data() + Header::bytes;
+  auto size = frame.size() - Header::bytes;
+  if (header.isEncoded) {
+    Codec::decode(data, size, elements, header.count);
+  } else {
+    if (size != header.count * sizeof(Element))
+      throw std::runtime_error("Token has the wrong size.");
+    memcpy(elements, data, size);
+  }
+}
+} // namespace detail
+
+// Writes the elements of token into frame, encoded by Codec unless they
+// are too few.
+template <class Codec, class T>
+void encode(T &token, std::vector<char> &frame) {
+  detail::encode<Codec>(token, frame, is_enabled<Codec>());
+}
+
+// Restores token from a frame written by encode.
+template <class Codec, class T>
+void decode(const std::vector<char> &frame, T &token) {
+  detail::decode<Codec>(frame, token, is_enabled<Codec>());
+}
+
+} // namespace codec
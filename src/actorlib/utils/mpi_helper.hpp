@@ -7,7 +7,10 @@
 
 #include "mpi.h"
 #include "mpi_type_traits.h"
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <type_traits>
 
 namespace mpi {
 
@@ -17,88 +20,113 @@ using tag = int;
 constexpr rank INVALID_RANK_ID = -1;
 constexpr tag DEFAULT_TAG_ID = 0;
 
-template <class T> class Request {
-public:
-  void wait() {
-    MPI_Wait(&request, &requestStatus);
-    requestCompleted = true;
-  }
+// Plain description of a point-to-point transfer. It is posted by the
+// ProgressEngine, which owns the resulting MPI_Request. Containers have
+// hasVaryingSize set: the engine sends their element count ahead of them
+// and passes it to resizeBuffer on the receiving side, which returns the
+// buffer. Control transfers, such as credits, use a communicator of their
+// own. Bounded transfers of containers hold at most count elements, which
+// both sides agreed on. Where the engine uses persistent requests, they go
+// without the count, and the receive passes the count that arrived to
+// resizeBuffer.
+struct Transfer {
+  bool isSend;
+  void *buffer;
+  int count;
+  MPI_Datatype datatype;
+  rank peer;
+  tag messageTag;
+  std::function<void *(int)> resizeBuffer;
+  bool isControl = false;
+  bool hasVaryingSize = false;
+  bool isBounded = false;
+};
 
-  bool hasFinished() {
-    if (requestCompleted)
-      return requestCompleted;
+template <class T> Transfer makeSend(rank peer, tag messageTag, T &data) {
+  Transfer transfer{true, mpi_type_traits<T>::get_addr(data),
+                    static_cast<int>(mpi_type_traits<T>::get_size(data)),
+                    mpi_type_traits<T>::get_type(T()), peer, messageTag,
+                    nullptr};
+  transfer.hasVaryingSize = is_dynamically_sized<T>::value;
+  return transfer;
+}
 
-    int flag = 0;
-    MPI_Test(&request, &flag, &requestStatus);
+template <class T>
+std::enable_if_t<!is_dynamically_sized<T>::value, Transfer>
+makeReceive(rank peer, tag messageTag, T *buffer) {
+  return {false, mpi_type_traits<T>::get_addr(*buffer),
+          static_cast<int>(mpi_type_traits<T>::get_size(*buffer)),
+          mpi_type_traits<T>::get_type(T()), peer, messageTag, nullptr};
+}
 
-    requestCompleted = static_cast<bool>(flag);
+template <class T>
+std::enable_if_t<is_dynamically_sized<T>::value, Transfer>
+makeReceive(rank peer, tag messageTag, T *buffer) {
+  Transfer transfer{false, nullptr, 0, mpi_type_traits<T>::get_type(T()),
+                    peer, messageTag, [buffer](int count) -> void * {
+                      return mpi_type_traits<T>::resize(*buffer, count);
+                    }};
+  transfer.hasVaryingSize = true;
+  return transfer;
+}
 
-    return requestCompleted;
-  }
+// Sends a container to a bounded receive, see Transfer. Other types are
+// sent as usual.
+template <class T>
+Transfer makeBoundedSend(rank peer, tag messageTag, T &data) {
+  return makeSend(peer, messageTag, data);
+}
 
-  bool isDirty() const { return rank != INVALID_RANK_ID; }
+template <class T>
+Transfer makeBoundedSend(rank peer, tag messageTag, std::vector<T> &data) {
+  auto transfer = makeSend(peer, messageTag, data);
+  transfer.isBounded = true;
+  return transfer;
+}
 
-protected:
-  Request()
-      : rank(INVALID_RANK_ID), tag(DEFAULT_TAG_ID), request(),
-        requestCompleted(false), requestStatus() {}
+// Receives a container of at most maxCount elements into the memory the
+// buffer already holds. Other types are received as usual.
+template <class T>
+Transfer makeBoundedReceive(rank peer, tag messageTag, T *buffer, size_t) {
+  return makeReceive(peer, messageTag, buffer);
+}
 
-  Request(rank rank, tag tag)
-      : rank(rank), tag(tag), request(), requestCompleted(false),
-        requestStatus() {}
+template <class T>
+Transfer makeBoundedReceive(rank peer, tag messageTag, std::vector<T> *buffer,
+                            size_t maxCount) {
+  buffer->resize(maxCount);
+  Transfer transfer{false, buffer->data(), static_cast<int>(maxCount),
+                    mpi_type_traits<std::vector<T>>::get_type(
+                        std::vector<T>()),
+                    peer, messageTag, [buffer](int count) -> void * {
+                      buffer->resize(count);
+                      return buffer->data();
+                    }};
+  transfer.hasVaryingSize = true;
+  transfer.isBounded = true;
+  return transfer;
+}
 
-  rank rank;
-  tag tag;
+// Hands the memory of a buffer that has been sent back to the pool.
+template <class T> void recycle(T &) {}
 
-  MPI_Request request;
-  bool requestCompleted;
-  MPI_Status requestStatus;
-};
+template <class T> void recycle(std::vector<T> &buffer) {
+  pool::SizeClassPool<T>::instance().release(std::move(buffer));
+  buffer = std::vector<T>();
+}
 
-template <class T> class SendRequest : public Request<T> {
-public:
-  SendRequest() : Request<T>(), localBuffer() {}
-
-  SendRequest(rank rank, tag tag, const T &data)
-      : Request<T>(rank, tag), localBuffer(data) {
-    send();
-  }
-
-  SendRequest(rank rank, tag tag, T &&data)
-      : Request<T>(rank, tag), localBuffer(std::forward<T>(data)) {
-    send();
-  }
-
-private:
-  void send() {
-    MPI_Issend(mpi_type_traits<T>::get_addr(localBuffer),
-               mpi_type_traits<T>::get_size(localBuffer),
-               mpi_type_traits<T>::get_type(std::move(localBuffer)), this->rank,
-               this->tag, MPI_COMM_WORLD, &this->request);
-  }
-  T localBuffer;
-};
+// A shared payload is only let go of, the next receive makes a new one.
+template <class T> void recycle(std::shared_ptr<const T> &buffer) {
+  buffer.reset();
+}
 
-template <class T> class ReceiveRequest : public Request<T> {
-public:
-  ReceiveRequest() : Request<T>(), channelBuffer(nullptr) {}
-
-  ReceiveRequest(rank rank, tag tag, T *buffer)
-      : Request<T>(rank, tag), channelBuffer(buffer) {
-    receive();
-  }
-
-  T *getBuffer() { return channelBuffer; }
-
-private:
-  void receive() {
-    MPI_Irecv(mpi_type_traits<T>::get_addr(*channelBuffer),
-              mpi_type_traits<T>::get_size(*channelBuffer),
-              mpi_type_traits<T>::get_type(std::move(*channelBuffer)),
-              this->rank, this->tag, MPI_COMM_WORLD, &this->request);
-  }
-  T *channelBuffer;
-};
+// Lets go of a shared payload, but keeps the memory of any other buffer
+// for whoever fills it in place next.
+template <class T> void vacate(T &) {}
+
+template <class T> void vacate(std::shared_ptr<const T> &buffer) {
+  buffer.reset();
+}
 
 static int me() {
   int rank;
@@ -112,14 +140,10 @@ static int world() {
   return worldSize;
 }
 
-template <typename T>
-SendRequest<T> static Isend(rank rank, tag tag, T &&data) {
-  return SendRequest<T>(rank, tag, std::forward<T>(data));
-}
-
-template <typename T>
-ReceiveRequest<T> static Irecv(rank rank, tag tag, T *buffer) {
-  return ReceiveRequest<T>(rank, tag, buffer);
+inline int threadLevel() {
+  int provided;
+  MPI_Query_thread(&provided);
+  return provided;
 }
 
 } // namespace mpi
@@ -26,15 +26,24 @@
 #include <array>
 #include <complex>
 #include <list>
+#include <memory>
 #include <mpi.h>
+#include <type_traits>
 #include <vector>
 
+#include "buffer_pool.hpp"
+
 namespace mpi {
 
 //*****************************************************************************
 // 									MPI Type
 // Traits
 //*****************************************************************************
+// Types whose length is only known once a message has arrived. They are
+// received by probing for the message first, and mpi_type_traits<T>::resize
+// makes room for the probed number of elements.
+template <class T> struct is_dynamically_sized : std::false_type {};
+
 template <class T> struct mpi_type_traits {
 
   typedef T element_type;
@@ -113,10 +122,62 @@ template <class T> struct mpi_type_traits<std::vector<T>> {
   }
 
   static inline element_addr_type get_addr(std::vector<T> &vec) {
-    return mpi_type_traits<T>::get_addr(vec.front());
+    return vec.data();
+  }
+
+  // The previous contents of the buffer go back to the pool.
+  static inline element_addr_type resize(std::vector<T> &vec, size_t count) {
+    auto &pool = pool::SizeClassPool<T>::instance();
+    pool.release(std::move(vec));
+    vec = pool.acquire(count);
+    return vec.data();
   }
 };
 
+template <class T>
+struct is_dynamically_sized<std::vector<T>> : std::true_type {};
+
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+//	std::shared_ptr<const T> traits
+//~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// A shared payload is transferred as its pointee. Sends only read from it.
+// Receives go into a new object, which is made as a mutable T, as the
+// payload the buffer held before may still be shared with a reader.
+template <class T> struct mpi_type_traits<std::shared_ptr<const T>> {
+
+  static inline T &get_object(std::shared_ptr<const T> &ptr) {
+    if (!ptr)
+      return make_object(ptr);
+    return const_cast<T &>(*ptr);
+  }
+
+  static inline T &make_object(std::shared_ptr<const T> &ptr) {
+    auto object = std::make_shared<T>();
+    ptr = object;
+    return *object;
+  }
+
+  static inline size_t get_size(std::shared_ptr<const T> &ptr) {
+    return mpi_type_traits<T>::get_size(get_object(ptr));
+  }
+
+  static inline MPI_Datatype get_type(std::shared_ptr<const T> &&) {
+    return mpi_type_traits<T>::get_type(T());
+  }
+
+  static inline auto get_addr(std::shared_ptr<const T> &ptr) {
+    return mpi_type_traits<T>::get_addr(get_object(ptr));
+  }
+
+  static inline auto resize(std::shared_ptr<const T> &ptr, size_t count) {
+    return mpi_type_traits<T>::resize(make_object(ptr), count);
+  }
+};
+
+template <class T>
+struct is_dynamically_sized<std::shared_ptr<const T>>
+    : is_dynamically_sized<T> {};
+
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 //	std::array<T> traits
 //~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
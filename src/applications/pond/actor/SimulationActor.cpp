@@ -41,6 +41,14 @@ SimulationActor::SimulationActor(Configuration &config, size_t xPos, size_t yPos
     dataOut[BND_BOTTOM] = (yPos != 0) ? this->makeOutPort<std::vector<float>, 32>("BND_BOTTOM") : nullptr;
     dataIn[BND_TOP] = (yPos != totalY - 1) ? this->makeInPort<std::vector<float>, 32>("BND_TOP") : nullptr;
     dataOut[BND_TOP] = (yPos != totalY - 1) ? this->makeOutPort<std::vector<float>, 32>("BND_TOP") : nullptr;
+    for (int i = 0; i < 4; i++) {
+        if (dataOut[i]) {
+            dataOut[i]->usePersistentRequests(3 * config.patchSize);
+        }
+        if (dataIn[i]) {
+            dataIn[i]->usePersistentRequests(3 * config.patchSize);
+        }
+    }
 #if defined(WRITENETCDF)
     writer = new io::NetCdfWriter(
             config.fileNameBase,
@@ -192,8 +200,8 @@ bool SimulationActor::hasReceivedTerminationSignal() {
 void SimulationActor::sendData() {
     for (int i = 0; i < 4; i++) {
         if (this->dataOut[i]) {
-            auto packedData = communicators[i].packCopyLayer();
-            dataOut[i]->write(packedData);
+            communicators[i].packCopyLayer(dataOut[i]->reserve());
+            dataOut[i]->commit();
         }
     }
 }
@@ -209,8 +217,8 @@ void SimulationActor::sendTerminationSignal() {
 void SimulationActor::receiveData() {
     for (int i = 0; i < 4; i++) {
         if (this->dataIn[i]) {
-            auto packedData = dataIn[i]->read();
-            communicators[i].receiveGhostLayer(packedData);
+            auto packedData = dataIn[i]->read_view();
+            communicators[i].receiveGhostLayer(*packedData);
         }
     }
 }
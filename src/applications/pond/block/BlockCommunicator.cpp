@@ -46,26 +46,26 @@ BlockCommunicator::BlockCommunicator(size_t patchSize, SWE_Block1D *copyLayer, S
       patchSize(patchSize) {
 }
 
-vector<float> BlockCommunicator::packCopyLayer() {
+void BlockCommunicator::packCopyLayer(vector<float> &res) {
     assert(patchSize > 0);
-    vector<float> res;
-    res.reserve(3 * patchSize);
+    // Packed in place into the send buffer of the port, which keeps its
+    // memory from step to step.
+    res.resize(3 * patchSize);
 
     for (size_t i = 0; i < patchSize; i++) {
-        res.push_back(copyLayer->h[i + 1]);
+        res[i] = copyLayer->h[i + 1];
     }
 
     for (size_t i = 0; i < patchSize; i++) {
-        res.push_back(copyLayer->hu[i + 1]);
+        res[patchSize + i] = copyLayer->hu[i + 1];
     }
 
     for (size_t i = 0; i < patchSize; i++) {
-        res.push_back(copyLayer->hv[i + 1]);
+        res[2 * patchSize + i] = copyLayer->hv[i + 1];
     }
-    return res;
 }
 
-void BlockCommunicator::receiveGhostLayer(vector<float> ghostLayerBuffer) {
+void BlockCommunicator::receiveGhostLayer(const vector<float> &ghostLayerBuffer) {
     assert(patchSize > 0);
     assert(ghostLayerBuffer.size() == 3 * this->patchSize);
 
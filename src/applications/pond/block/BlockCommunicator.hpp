@@ -41,6 +41,6 @@ struct BlockCommunicator {
     BlockCommunicator();
     BlockCommunicator(size_t patchSize, SWE_Block1D *copyLayer, SWE_Block1D *ghostLayer);
 
-    std::vector<float> packCopyLayer();
-    void receiveGhostLayer(std::vector<float> ghostLayerBuffer);
+    void packCopyLayer(std::vector<float> &buffer);
+    void receiveGhostLayer(const std::vector<float> &ghostLayerBuffer);
 };
@@ -37,7 +37,11 @@ std::string PingPongActor::OUT_PORT_NAME = "OUT";
 
 PingPongActor::PingPongActor(const std::string &name)
     : Actor(name), ip(makeInPort<size_t, 10>(IN_PORT_NAME)),
-      op(makeOutPort<size_t, 10>(OUT_PORT_NAME)), begin(true) {}
+      op(makeOutPort<size_t, 10>(OUT_PORT_NAME)), begin(true) {
+  addFiringRule(FiringRule().consume(ip).produce(op));
+  addFiringRule(FiringRule().produce(op).guard(
+      [this]() { return this->name == "A-0-0" && this->begin; }));
+}
 
 bool PingPongActor::act() {
   std::cout << name << " act() has been called."